@@ -0,0 +1,444 @@
+/********************************************************************
+ *
+ * crcbench.c -- CRC and firmware check benchmark
+ *
+ * Copyright (C) 2021 SCS GmbH & Co. KG, Hanau, Germany
+ * written by Peter Mack (peter.mack@scs-ptc.com)
+ *
+ * MIT License
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ *
+ ********************************************************************/
+
+
+#define _GNU_SOURCE
+
+/********************************************************************
+ * Include files
+ ********************************************************************/
+#include <stdio.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <time.h>
+#include <sys/ioctl.h>
+#include <sys/syscall.h>
+#include <sys/utsname.h>
+#include <linux/perf_event.h>
+#if defined(__x86_64__) || defined(__i386__)
+#include <x86intrin.h>
+#endif
+
+#include "crc.h"
+#include "fwimage.h"
+#include "dr7chk.h"
+#include "ptcchk.h"
+
+
+/********************************************************************
+ * Defines
+ ********************************************************************/
+#define MIN_TIME_NS	200000000LL		// run every case at least 200 ms
+#ifndef VERSION
+#define VERSION "x.x"
+#endif
+
+
+/********************************************************************
+ * Types
+ ********************************************************************/
+struct bench_result {
+	const char *name;
+	const char *variant;
+	size_t size;			// bytes per operation
+	long iterations;
+	long long ns;			// total time
+	long long syscalls;		// total read/write syscalls
+	long long cycles;		// total cycles, negative = not available
+};
+
+
+/********************************************************************
+ * Global variables
+ ********************************************************************/
+static int perf_fd = -1;
+static const char *cycle_source = "none";
+static int first = 1;
+static FILE *out;
+
+
+/********************************************************************
+ * Monotonic clock in ns
+ ********************************************************************/
+static long long now_ns (void)
+{
+	struct timespec ts;
+
+	clock_gettime (CLOCK_MONOTONIC, &ts);
+
+	return (long long) ts.tv_sec * 1000000000LL + ts.tv_nsec;
+}
+
+/********************************************************************
+ * Read and write syscalls of this process so far
+ *  from /proc/self/io (syscr + syscw)
+ ********************************************************************/
+static long long syscalls (void)
+{
+	char line[128];
+	long long v, sum = 0;
+	FILE *f;
+
+	f = fopen ("/proc/self/io", "r");
+	if (NULL == f)
+	{
+		return 0;
+	}
+
+	while (fgets (line, sizeof (line), f))
+	{
+		if (1 == sscanf (line, "syscr: %lld", &v) || 1 == sscanf (line, "syscw: %lld", &v))
+		{
+			sum += v;
+		}
+	}
+	fclose (f);
+
+	// the fopen/fgets/fclose above are counted as well
+	return sum;
+}
+
+/********************************************************************
+ * CPU cycle counter
+ *  perf hardware counter if permitted, TSC on x86 otherwise
+ ********************************************************************/
+static void cycles_init (void)
+{
+	struct perf_event_attr pe;
+
+	memset (&pe, 0, sizeof (pe));
+	pe.type = PERF_TYPE_HARDWARE;
+	pe.size = sizeof (pe);
+	pe.config = PERF_COUNT_HW_CPU_CYCLES;
+	pe.exclude_hv = 1;
+
+	perf_fd = syscall (SYS_perf_event_open, &pe, 0, -1, -1, 0);
+	if (perf_fd >= 0)
+	{
+		ioctl (perf_fd, PERF_EVENT_IOC_ENABLE, 0);
+		cycle_source = "perf";
+		return;
+	}
+
+#if defined(__x86_64__) || defined(__i386__)
+	cycle_source = "tsc";
+#endif
+}
+
+static long long cycles (void)
+{
+	long long c;
+
+	if (perf_fd >= 0 && sizeof (c) == read (perf_fd, &c, sizeof (c)))
+	{
+		return c;
+	}
+
+#if defined(__x86_64__) || defined(__i386__)
+	return __rdtsc ();
+#else
+	return -1;
+#endif
+}
+
+/********************************************************************
+ * Print one result as JSON object
+ ********************************************************************/
+static void report (const struct bench_result *r)
+{
+	double mbs = (double) r->size * r->iterations / (r->ns / 1e9) / 1e6;
+
+	fprintf (out, "%s\n    {\"name\": \"%s\", \"variant\": \"%s\", \"size\": %zu, \"iterations\": %ld, "
+			 "\"ns_per_op\": %.0f, \"mb_per_s\": %.1f, \"rw_syscalls_per_op\": %.1f, \"cycles_per_byte\": ",
+			 first ? "" : ",",
+			 r->name, r->variant, r->size, r->iterations,
+			 (double) r->ns / r->iterations, mbs,
+			 (double) r->syscalls / r->iterations);
+
+	if (r->cycles >= 0 && r->size)
+	{
+		fprintf (out, "%.3f}", (double) r->cycles / r->iterations / r->size);
+	}
+	else
+	{
+		fprintf (out, "null}");
+	}
+	first = 0;
+
+	fprintf (stderr, "%-10s %-8s %9zu byte  %9.1f MB/s\n", r->name, r->variant, r->size, mbs);
+}
+
+/********************************************************************
+ * Synthetic firmware images
+ *  same layout as dr7check() and ptccheck() expect
+ ********************************************************************/
+static void fill (uint8_t *p, size_t n, uint32_t seed)
+{
+	while (n--)
+	{
+		seed = seed * 1103515245 + 12345;
+		*p++ = seed >> 16;
+	}
+}
+
+static void put_word (uint8_t *p, uint16_t v)
+{
+	p[0] = v;
+	p[1] = v >> 8;
+}
+
+static void put_long (uint8_t *p, uint32_t v)
+{
+	p[0] = v;
+	p[1] = v >> 8;
+	p[2] = v >> 16;
+	p[3] = v >> 24;
+}
+
+static int make_image (char *path, uint16_t header, size_t length)
+{
+	struct crc32_ctx ctx;
+	uint8_t *buf;
+	size_t size;
+	FILE *f;
+	int fd;
+
+	strcpy (path, "/tmp/scsbenchXXXXXX");
+	fd = mkstemp (path);
+	if (fd < 0)
+	{
+		return -1;
+	}
+	f = fdopen (fd, "w");
+
+	size = length + 10;
+	buf = malloc (size);
+	fill (buf, size, length);
+	memset (buf + size - 2, 0, 2);
+
+	crc32_init (&ctx);
+	if (HEADER_P4 == header)
+	{
+		put_word (buf, HEADER_P4);
+		put_word (buf + 2, 1);
+		put_long (buf + 4, length);
+		crc32_update (&ctx, buf, length);
+		put_long (buf + length, crc32_final (&ctx));
+		size = length + 4;
+	}
+	else
+	{
+		put_word (buf, HEADER_PT);
+		put_word (buf + 2, length);
+		crc32_update (&ctx, buf + 4, length);
+		put_long (buf + 4 + length, crc32_final (&ctx));
+	}
+
+	fwrite (buf, 1, size, f);
+	fclose (f);
+	free (buf);
+
+	return 0;
+}
+
+/********************************************************************
+ * Benchmark a CRC kernel
+ ********************************************************************/
+static void bench_kernel (const struct crc32_backend *b, const uint8_t *buf, size_t len)
+{
+	struct bench_result r = { "crc32", b->name, len, 0, 0, 0, 0 };
+	volatile uint32_t sink;
+	long long t0, c0, s0;
+
+	s0 = syscalls ();
+	c0 = cycles ();
+	t0 = now_ns ();
+	do
+	{
+		sink = b->update (CRC_MASK, buf, len);
+		r.iterations++;
+		r.ns = now_ns () - t0;
+	}
+	while (r.ns < MIN_TIME_NS);
+	r.cycles = c0 < 0 ? -1 : cycles () - c0;
+	r.syscalls = syscalls () - s0;
+	(void) sink;
+
+	report (&r);
+}
+
+/********************************************************************
+ * Benchmark crc32_parallel
+ ********************************************************************/
+static void bench_parallel (const uint8_t *buf, size_t len)
+{
+	struct bench_result r = { "crc32", "parallel", len, 0, 0, 0, 0 };
+	volatile uint32_t sink;
+	long long t0, c0, s0;
+
+	s0 = syscalls ();
+	c0 = cycles ();
+	t0 = now_ns ();
+	do
+	{
+		sink = crc32_parallel (buf, len, 0);
+		r.iterations++;
+		r.ns = now_ns () - t0;
+	}
+	while (r.ns < MIN_TIME_NS);
+	r.cycles = c0 < 0 ? -1 : cycles () - c0;
+	r.syscalls = syscalls () - s0;
+	(void) sink;
+
+	report (&r);
+}
+
+/********************************************************************
+ * Benchmark open + check of a firmware file
+ ********************************************************************/
+static void bench_check (const char *name, uint16_t header, size_t length)
+{
+	struct bench_result r = { name, "file", 0, 0, 0, 0, 0 };
+	struct fw_image img;
+	char path[32];
+	long long t0, c0, s0, ns;
+	int res = 0;
+
+	if (make_image (path, header, length))
+	{
+		fprintf (stderr, "ERROR: could not create test image\n");
+		return;
+	}
+
+	s0 = syscalls ();
+	c0 = cycles ();
+	t0 = now_ns ();
+	do
+	{
+		if (fw_open (&img, path))
+		{
+			res = -1;
+			break;
+		}
+		r.size = img.size;
+		res |= HEADER_P4 == header ? dr7check (&img) : ptccheck (&img);
+		fw_close (&img);
+		r.iterations++;
+		ns = now_ns () - t0;
+	}
+	while (ns < MIN_TIME_NS);
+	r.ns = now_ns () - t0;
+	r.cycles = c0 < 0 ? -1 : cycles () - c0;
+	r.syscalls = syscalls () - s0;
+
+	unlink (path);
+
+	if (res)
+	{
+		fprintf (stderr, "ERROR: %s check of the test image failed\n", name);
+		return;
+	}
+
+	report (&r);
+}
+
+/********************************************************************
+ * Main function
+ ********************************************************************/
+int main (int argc, char *argv[])
+{
+	static const size_t kernel_sizes[] = { 256, 4096, 65536, 1048576, 8388608 };
+	static const size_t p4_sizes[] = { 65536, 1048576, 2097152, 8388608 };
+	static const size_t pt_sizes[] = { 16384, 65000 };
+	const struct crc32_backend *b;
+	struct utsname un;
+	uint8_t *buf;
+	size_t i;
+
+	out = stdout;
+	if (argc > 1)
+	{
+		out = fopen (argv[1], "w");
+		if (NULL == out)
+		{
+			fprintf (stderr, "ERROR: could not open %s\n", argv[1]);
+			return EXIT_FAILURE;
+		}
+	}
+
+	cycles_init ();
+	uname (&un);
+
+	fprintf (out, "{\n  \"version\": \"%s\",\n  \"machine\": \"%s\",\n  \"cpus\": %ld,\n"
+			 "  \"crc_backend\": \"%s\",\n  \"selftest_failures\": %d,\n  \"cycle_source\": \"%s\",\n  \"results\": [",
+			 VERSION, un.machine, sysconf (_SC_NPROCESSORS_ONLN),
+			 crc32_get_backend ()->name, crc32_selftest (), cycle_source);
+
+	buf = malloc (kernel_sizes[sizeof (kernel_sizes) / sizeof (kernel_sizes[0]) - 1]);
+	fill (buf, kernel_sizes[sizeof (kernel_sizes) / sizeof (kernel_sizes[0]) - 1], 1);
+
+	for (b = crc32_backends; b->name; b++)
+	{
+		if (b->supported && !b->supported ())
+		{
+			continue;
+		}
+		for (i = 0; i < sizeof (kernel_sizes) / sizeof (kernel_sizes[0]); i++)
+		{
+			bench_kernel (b, buf, kernel_sizes[i]);
+		}
+	}
+
+	for (i = 0; i < sizeof (kernel_sizes) / sizeof (kernel_sizes[0]); i++)
+	{
+		bench_parallel (buf, kernel_sizes[i]);
+	}
+	free (buf);
+
+	for (i = 0; i < sizeof (p4_sizes) / sizeof (p4_sizes[0]); i++)
+	{
+		bench_check ("dr7check", HEADER_P4, p4_sizes[i]);
+	}
+
+	for (i = 0; i < sizeof (pt_sizes) / sizeof (pt_sizes[0]); i++)
+	{
+		bench_check ("ptccheck", HEADER_PT, pt_sizes[i]);
+	}
+
+	fprintf (out, "\n  ]\n}\n");
+
+	if (out != stdout)
+	{
+		fclose (out);
+	}
+
+	return EXIT_SUCCESS;
+}
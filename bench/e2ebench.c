@@ -0,0 +1,560 @@
+/********************************************************************
+ *
+ * e2ebench.c -- end-to-end update benchmark against the modem simulator
+ *
+ * Copyright (C) 2021 SCS GmbH & Co. KG, Hanau, Germany
+ * written by Peter Mack (peter.mack@scs-ptc.com)
+ *
+ * MIT License
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ *
+ ********************************************************************/
+
+#define _GNU_SOURCE
+
+/********************************************************************
+ * Include files
+ ********************************************************************/
+#include <stdio.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <getopt.h>
+#include <signal.h>
+#include <sys/wait.h>
+#include <sys/utsname.h>
+
+#include "crc.h"
+#include "fwimage.h"
+#include "serial.h"
+#include "ptc.h"
+#include "timing.h"
+#include "update.h"
+
+
+/********************************************************************
+ * Defines
+ ********************************************************************/
+#define SIM_PATH		"sim/scsupdate-sim"
+#define CMD_ROUNDS		50			// PTC_cmd() round trips per case
+#define VERSION_ROUNDS	10			// PTC_getVersion() round trips per case
+#define SIM_STAMP		"--stamp=52210000"	// FDTIME 2021-01-01, no warning from update()
+#define TOLERANCE_PCT	5.0			// slower than the baseline by more = regression
+#define MAX_SWEEP		16
+#ifndef VERSION
+#define VERSION "x.x"
+#endif
+
+
+/********************************************************************
+ * Types
+ ********************************************************************/
+struct sweep {
+	long value[MAX_SWEEP];
+	int count;
+};
+
+struct e2e_result {
+	char name[64];
+	long baud;				// sim pacing, 0 = unpaced
+	long ack_us;			// sim ACK latency
+	size_t size;			// image bytes
+	int result;				// update() return value
+	long long ns;			// update() wall time
+	unsigned long chunks;
+	long long syscalls;		// read/write syscalls during update()
+	struct histogram cmd_us;
+	struct histogram ver_us;
+	struct timing tm;
+};
+
+
+/********************************************************************
+ * Global variables
+ ********************************************************************/
+static const char *sim_path = SIM_PATH;
+static const char *baseline;
+static double tolerance = TOLERANCE_PCT;
+static int regressions;
+static int first = 1;
+static FILE *out;
+
+
+/********************************************************************
+ * Read and write syscalls of this process so far
+ *  from /proc/self/io (syscr + syscw)
+ ********************************************************************/
+static long long syscalls (void)
+{
+	char line[128];
+	long long v, sum = 0;
+	FILE *f;
+
+	f = fopen ("/proc/self/io", "r");
+	if (NULL == f)
+	{
+		return 0;
+	}
+
+	while (fgets (line, sizeof (line), f))
+	{
+		if (1 == sscanf (line, "syscr: %lld", &v) || 1 == sscanf (line, "syscw: %lld", &v))
+		{
+			sum += v;
+		}
+	}
+	fclose (f);
+
+	return sum;
+}
+
+/********************************************************************
+ * Comma separated list of numbers
+ *  Return: 0 = Ok, -1 = Error
+ ********************************************************************/
+static int parse_sweep (struct sweep *sw, const char *s)
+{
+	char *end;
+
+	sw->count = 0;
+	while (*s && sw->count < MAX_SWEEP)
+	{
+		sw->value[sw->count++] = strtol (s, &end, 10);
+		if (end == s || (*end && *end != ','))
+		{
+			return -1;
+		}
+		s = *end ? end + 1 : end;
+	}
+
+	return sw->count ? 0 : -1;
+}
+
+/********************************************************************
+ * Synthetic DR-7x00 image with a valid CRC
+ *  same layout as dr7check() expects
+ ********************************************************************/
+static void put_long (uint8_t *p, uint32_t v)
+{
+	p[0] = v;
+	p[1] = v >> 8;
+	p[2] = v >> 16;
+	p[3] = v >> 24;
+}
+
+static int make_image (char *path, size_t length)
+{
+	struct crc32_ctx ctx;
+	uint32_t seed = length;
+	uint8_t *buf;
+	size_t i;
+	FILE *f;
+	int fd;
+
+	strcpy (path, "/tmp/scse2eXXXXXX.dr7");
+	fd = mkstemps (path, 4);
+	if (fd < 0)
+	{
+		return -1;
+	}
+	f = fdopen (fd, "w");
+
+	buf = malloc (length + 4);
+	for (i = 0; i < length; i++)
+	{
+		seed = seed * 1103515245 + 12345;
+		buf[i] = seed >> 16;
+	}
+	buf[0] = HEADER_P4 & 0xff;
+	buf[1] = HEADER_P4 >> 8;
+	buf[2] = 1;
+	buf[3] = 0;
+	put_long (buf + 4, length);
+
+	crc32_init (&ctx);
+	crc32_update (&ctx, buf, length);
+	put_long (buf + length, crc32_final (&ctx));
+
+	fwrite (buf, 1, length + 4, f);
+	fclose (f);
+	free (buf);
+
+	return 0;
+}
+
+/********************************************************************
+ * Start the simulator for one update
+ *  Return: pid, -1 = Error
+ *          the name of its pseudo terminal in tty
+ ********************************************************************/
+static pid_t sim_start (long baud, long ack_us, char *tty, size_t len)
+{
+	char arg_baud[32], arg_ack[32];
+	int pfd[2];
+	ssize_t n;
+	size_t got = 0;
+	pid_t pid;
+	int null;
+
+	if (pipe (pfd))
+	{
+		return -1;
+	}
+
+	pid = fork ();
+	if (pid < 0)
+	{
+		return -1;
+	}
+
+	if (0 == pid)
+	{
+		snprintf (arg_baud, sizeof (arg_baud), "--baud=%ld", baud);
+		snprintf (arg_ack, sizeof (arg_ack), "--ack-delay=%ld", ack_us);
+		null = open ("/dev/null", O_WRONLY);
+		dup2 (pfd[1], STDOUT_FILENO);
+		dup2 (null, STDERR_FILENO);
+		close (pfd[0]);
+		close (pfd[1]);
+		execl (sim_path, sim_path, "--once", "--output=/dev/null", SIM_STAMP, arg_baud, arg_ack, (char *) NULL);
+		_exit (127);
+	}
+
+	close (pfd[1]);
+	while (got < len - 1 && (n = read (pfd[0], tty + got, 1)) == 1 && tty[got] != '\n')
+	{
+		got++;
+	}
+	tty[got] = '\0';
+	close (pfd[0]);
+
+	if (0 == got)
+	{
+		fprintf (stderr, "ERROR: could not start %s\n", sim_path);
+		waitpid (pid, NULL, 0);
+		return -1;
+	}
+
+	return pid;
+}
+
+/********************************************************************
+ * Bytes per second of a case in the baseline file
+ *  one result per line, as written by report()
+ *  Return: bytes/s, negative = not found
+ ********************************************************************/
+static double baseline_rate (const char *name)
+{
+	char line[1024], key[80];
+	double rate = -1;
+	char *p;
+	FILE *f;
+
+	f = fopen (baseline, "r");
+	if (NULL == f)
+	{
+		return -1;
+	}
+
+	snprintf (key, sizeof (key), "\"name\": \"%s\"", name);
+	while (fgets (line, sizeof (line), f))
+	{
+		if (strstr (line, key) && (p = strstr (line, "\"bytes_per_s\": ")))
+		{
+			rate = strtod (p + 15, NULL);
+			break;
+		}
+	}
+	fclose (f);
+
+	return rate;
+}
+
+/********************************************************************
+ * Print one result as JSON object, one line per case
+ ********************************************************************/
+static void report (const struct e2e_result *r)
+{
+	double secs = r->ns / 1e9;
+	double rate = r->result ? 0 : r->size / secs;
+	double line_rate = r->baud / 10.0;
+	const struct histogram *ack = &r->tm.ack_us;
+	double base = -1;
+
+	fprintf (out, "%s\n    {\"name\": \"%s\", \"baud\": %ld, \"ack_us\": %ld, \"size\": %zu, \"ok\": %s, "
+			 "\"seconds\": %.3f, \"bytes_per_s\": %.0f, ",
+			 first ? "" : ",",
+			 r->name, r->baud, r->ack_us, r->size, r->result ? "false" : "true",
+			 secs, rate);
+	first = 0;
+
+	if (r->baud)
+	{
+		fprintf (out, "\"line_rate\": %.0f, \"efficiency\": %.3f, ", line_rate, rate / line_rate);
+	}
+	else
+	{
+		fprintf (out, "\"line_rate\": null, \"efficiency\": null, ");
+	}
+
+	fprintf (out, "\"chunk_us\": {\"p50\": %llu, \"p90\": %llu, \"p99\": %llu, \"max\": %llu}, "
+			 "\"cmd_rtt_us\": {\"p50\": %llu, \"p99\": %llu}, \"version_rtt_us\": {\"p50\": %llu, \"p99\": %llu}, "
+			 "\"rw_syscalls_per_chunk\": %.2f",
+			 (unsigned long long) hist_percentile (ack, 50),
+			 (unsigned long long) hist_percentile (ack, 90),
+			 (unsigned long long) hist_percentile (ack, 99),
+			 (unsigned long long) ack->max,
+			 (unsigned long long) hist_percentile (&r->cmd_us, 50),
+			 (unsigned long long) hist_percentile (&r->cmd_us, 99),
+			 (unsigned long long) hist_percentile (&r->ver_us, 50),
+			 (unsigned long long) hist_percentile (&r->ver_us, 99),
+			 r->chunks ? (double) r->syscalls / r->chunks : 0.0);
+
+	if (baseline)
+	{
+		base = baseline_rate (r->name);
+	}
+	if (base > 0)
+	{
+		fprintf (out, ", \"baseline_bytes_per_s\": %.0f, \"change_pct\": %.1f", base, (rate / base - 1) * 100);
+		if (rate < base * (1 - tolerance / 100))
+		{
+			regressions++;
+		}
+	}
+	fprintf (out, "}");
+
+	fprintf (stderr, "%-24s %9.0f byte/s", r->name, rate);
+	if (r->baud)
+	{
+		fprintf (stderr, "  %5.1f %% of line", rate / line_rate * 100);
+	}
+	fprintf (stderr, "  ack p50 %5llu us  cmd p50 %5llu us",
+			 (unsigned long long) hist_percentile (ack, 50),
+			 (unsigned long long) hist_percentile (&r->cmd_us, 50));
+	if (base > 0)
+	{
+		fprintf (stderr, "  %+.1f %%", (rate / base - 1) * 100);
+	}
+	fprintf (stderr, "%s\n", r->result ? "  FAILED" : "");
+}
+
+/********************************************************************
+ * One case: command round trips and a full update
+ *  Return: 0 = Ok, -1 = Error
+ ********************************************************************/
+static int bench_case (long baud, long ack_us, size_t size)
+{
+	struct e2e_result r;
+	struct modemtype modem;
+	struct ser_port *ser;
+	char path[32], tty[256];
+	long long t, sc;
+	pid_t pid;
+	int i, status;
+
+	memset (&r, 0, sizeof (r));
+	snprintf (r.name, sizeof (r.name), "b%ld_a%ld_s%zu", baud, ack_us, size);
+	r.baud = baud;
+	r.ack_us = ack_us;
+	r.size = size;
+	r.result = -1;
+
+	if (make_image (path, size))
+	{
+		fprintf (stderr, "ERROR: could not create a test image\n");
+		return -1;
+	}
+
+	pid = sim_start (baud, ack_us, tty, sizeof (tty));
+	if (pid < 0)
+	{
+		unlink (path);
+		return -1;
+	}
+
+	ser = ser_open (tty, 115200);
+	if (NULL == ser)
+	{
+		kill (pid, SIGTERM);
+		waitpid (pid, NULL, 0);
+		unlink (path);
+		return -1;
+	}
+
+	PTC_cmd (ser, "\r", 1);
+
+	for (i = 0; i < CMD_ROUNDS; i++)
+	{
+		t = timing_now_ns ();
+		if (PTC_cmd (ser, "\r", 1))
+		{
+			break;
+		}
+		hist_add (&r.cmd_us, (timing_now_ns () - t) / 1000);
+	}
+
+	for (i = 0; i < VERSION_ROUNDS; i++)
+	{
+		t = timing_now_ns ();
+		modem = PTC_getVersion (ser);
+		hist_add (&r.ver_us, (timing_now_ns () - t) / 1000);
+	}
+
+	timing_init (&r.tm);
+	if (modem.ver)
+	{
+		sc = syscalls ();
+		t = timing_now_ns ();
+		r.result = update (ser, modem, path, &r.tm, NULL);
+		r.ns = timing_now_ns () - t;
+		r.syscalls = syscalls () - sc;
+		r.chunks = r.tm.chunks;
+	}
+
+	ser_close (ser);
+	if (r.result)
+	{
+		kill (pid, SIGTERM);
+	}
+	waitpid (pid, &status, 0);
+	unlink (path);
+
+	report (&r);
+	timing_free (&r.tm);
+
+	return r.result ? -1 : 0;
+}
+
+/********************************************************************
+ * Usage
+ ********************************************************************/
+static void usage (void)
+{
+	fprintf (stderr, "\nUsage:\n");
+	fprintf (stderr, "  e2ebench [options] [output.json]\n");
+	fprintf (stderr, "    runs update() and PTC_cmd() against scsupdate-sim\n\n");
+	fprintf (stderr, "Options:\n");
+	fprintf (stderr, "  --sim=<path>        simulator (default %s)\n", SIM_PATH);
+	fprintf (stderr, "  --baud=<n,...>      emulated baud rates, 0 = unpaced\n");
+	fprintf (stderr, "  --ack=<us,...>      ACK latencies of the modem\n");
+	fprintf (stderr, "  --size=<n,...>      image sizes in bytes\n");
+	fprintf (stderr, "  --baseline=<file>   compare with an earlier result\n");
+	fprintf (stderr, "  --tolerance=<pct>   allowed slow down (default %.0f %%)\n\n", TOLERANCE_PCT);
+	fprintf (stderr, "Exit code 2 if a case is slower than the baseline.\n\n");
+	exit (1);
+}
+
+/********************************************************************
+ * Main function
+ ********************************************************************/
+int main (int argc, char *argv[])
+{
+	struct sweep bauds = { { 115200, 921600, 0 }, 3 };
+	struct sweep acks = { { 0, 1000 }, 2 };
+	struct sweep sizes = { { 16384, 131072 }, 2 };
+	struct utsname un;
+	int failed = 0;
+	int a, b, s;
+	int opt;
+
+	static const struct option options[] = {
+		{"sim",			required_argument,	NULL, 's'},
+		{"baud",		required_argument,	NULL, 'b'},
+		{"ack",			required_argument,	NULL, 'a'},
+		{"size",		required_argument,	NULL, 'z'},
+		{"baseline",	required_argument,	NULL, 'B'},
+		{"tolerance",	required_argument,	NULL, 't'},
+		{"help",		no_argument,		NULL, 'h'},
+		{NULL, 0, NULL, 0}
+	};
+
+	while ((opt = getopt_long (argc, argv, "h", options, NULL)) != -1)
+	{
+		switch (opt)
+		{
+			case 's': sim_path = optarg; break;
+			case 'b': if (parse_sweep (&bauds, optarg)) usage (); break;
+			case 'a': if (parse_sweep (&acks, optarg)) usage (); break;
+			case 'z': if (parse_sweep (&sizes, optarg)) usage (); break;
+			case 'B': baseline = optarg; break;
+			case 't': tolerance = strtod (optarg, NULL); break;
+			default: usage ();
+		}
+	}
+
+	if (access (sim_path, X_OK))
+	{
+		fprintf (stderr, "ERROR: %s not found, run make sim first\n", sim_path);
+		return EXIT_FAILURE;
+	}
+
+	if (optind < argc)
+	{
+		out = fopen (argv[optind], "w");
+	}
+	else
+	{
+		out = fdopen (dup (STDOUT_FILENO), "w");
+	}
+	if (NULL == out)
+	{
+		fprintf (stderr, "ERROR: could not open %s\n", optind < argc ? argv[optind] : "stdout");
+		return EXIT_FAILURE;
+	}
+
+	// update() talks to the user on stdout
+	fflush (stdout);
+	dup2 (open ("/dev/null", O_WRONLY), STDOUT_FILENO);
+
+	uname (&un);
+
+	fprintf (out, "{\n  \"version\": \"%s\",\n  \"machine\": \"%s\",\n  \"chunk_size\": %d,\n"
+			 "  \"baseline\": %s%s%s,\n  \"results\": [",
+			 VERSION, un.machine, CHUNKSIZE,
+			 baseline ? "\"" : "", baseline ? baseline : "null", baseline ? "\"" : "");
+
+	for (b = 0; b < bauds.count; b++)
+	{
+		for (a = 0; a < acks.count; a++)
+		{
+			for (s = 0; s < sizes.count; s++)
+			{
+				if (bench_case (bauds.value[b], acks.value[a], sizes.value[s]))
+				{
+					failed++;
+				}
+			}
+		}
+	}
+
+	fprintf (out, "\n  ],\n  \"failed\": %d,\n  \"regressions\": %d\n}\n", failed, regressions);
+
+	fclose (out);
+
+	if (failed)
+	{
+		return EXIT_FAILURE;
+	}
+
+	return regressions ? 2 : EXIT_SUCCESS;
+}
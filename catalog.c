@@ -0,0 +1,354 @@
+/********************************************************************
+ *
+ * catalog.c -- firmware catalog and validation cache
+ *
+ * Copyright (C) 2013 -2021 SCS GmbH & Co. KG, Hanau, Germany
+ * written by Peter Mack (peter.mack@scs-ptc.com)
+ *
+ * MIT License
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ *
+ ********************************************************************/
+
+
+#define _GNU_SOURCE
+
+/********************************************************************
+ * Include files
+ ********************************************************************/
+#include <stdio.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <dirent.h>
+#include <limits.h>
+#include <pthread.h>
+
+#include "ptc.h"
+#include "fwimage.h"
+#include "dr7chk.h"
+#include "ptcchk.h"
+#include "catalog.h"
+
+
+/********************************************************************
+ * Types
+ ********************************************************************/
+struct catalog_job {
+	const char *dir;
+	struct catalog_entry *entries;
+	int count;
+	int next;				// next entry to check
+	pthread_mutex_t lock;
+};
+
+
+/********************************************************************
+ * Run the firmware check matching the image header
+ *  on one thread, the catalog workers already use every CPU
+ * Return:
+ *  0 = Ok
+ *  negative = Error
+ ********************************************************************/
+int catalog_check_image (const struct fw_image *img)
+{
+	if (HEADER_P4 == img->header)
+	{
+		return dr7check (img, 1);
+	}
+
+	return ptccheck (img, 1);
+}
+
+/********************************************************************
+ * Helper function for scandir
+ * to find the firmware files
+ ********************************************************************/
+static int catalog_filter (const struct dirent *ep)
+{
+	const char *ext;
+
+	ext = strrchr (ep->d_name, '.');
+	if (NULL == ext || strpbrk (ep->d_name, "\t\n"))
+	{
+		return 0;
+	}
+
+	return NULL != PTC_getModemByExt (ext + 1);
+}
+
+/********************************************************************
+ * Worker thread: check catalog entries until none are left
+ ********************************************************************/
+static void *catalog_worker (void *arg)
+{
+	struct catalog_job *job = arg;
+	struct catalog_entry *e;
+	struct fw_image img;
+	char path[PATH_MAX];
+	int i;
+
+	for (;;)
+	{
+		pthread_mutex_lock (&job->lock);
+		i = job->next++;
+		pthread_mutex_unlock (&job->lock);
+
+		if (i >= job->count)
+		{
+			break;
+		}
+
+		e = &job->entries[i];
+		snprintf (path, sizeof (path), "%s/%s", job->dir, e->name);
+
+		e->result = -1;
+		if (fw_open (&img, path))
+		{
+			continue;
+		}
+
+		// the file that was checked, even if the path changes meanwhile
+		e->size = img.size;
+		e->mtime_ns = img.mtime_ns;
+		e->ino = img.ino;
+
+		e->header = img.header;
+		e->stamp = fw_get_long (&img, FW_STAMP_OFFSET);
+		e->result = catalog_check_image (&img);
+
+		fw_close (&img);
+	}
+
+	return NULL;
+}
+
+/********************************************************************
+ * Write the index file
+ *  to a temporary file first, so readers never see a partial index
+ * Return:
+ *  0 = Ok
+ *  negative = Error
+ ********************************************************************/
+static int catalog_write (const char *dir, const struct catalog_entry *entries, int count)
+{
+	char path[PATH_MAX];
+	char tmp[PATH_MAX + 16];
+	FILE *f;
+	int i;
+
+	snprintf (path, sizeof (path), "%s/" CATALOG_INDEX, dir);
+	snprintf (tmp, sizeof (tmp), "%s.%d", path, getpid ());
+
+	f = fopen (tmp, "w");
+	if (NULL == f)
+	{
+		fprintf (stderr, "ERROR: could not write %s\n", path);
+		return -1;
+	}
+
+	fprintf (f, CATALOG_MAGIC "\n");
+	for (i = 0; i < count; i++)
+	{
+		fprintf (f, "%s\t%lld\t%lld\t%llu\t%04x\t%d\t%08x\n",
+				 entries[i].name,
+				 (long long) entries[i].size,
+				 entries[i].mtime_ns,
+				 (unsigned long long) entries[i].ino,
+				 entries[i].header,
+				 entries[i].result,
+				 entries[i].stamp);
+	}
+
+	if (fclose (f) || rename (tmp, path))
+	{
+		fprintf (stderr, "ERROR: could not write %s\n", path);
+		unlink (tmp);
+		return -1;
+	}
+
+	return 0;
+}
+
+/********************************************************************
+ * Check all firmware files of a directory in parallel
+ * and record the results in the index file
+ *  threads <= 0 uses one thread per online CPU
+ * Return:
+ *  number of files that failed the check
+ *  negative = Error
+ ********************************************************************/
+int catalog_build (const char *dir, int threads)
+{
+	struct catalog_job job;
+	struct dirent **ent;
+	pthread_t *tids;
+	FDTIME t;
+	int started;
+	int failed = 0;
+	int n, i;
+
+	n = scandir (dir, &ent, catalog_filter, alphasort);
+	if (n < 0)
+	{
+		fprintf (stderr, "ERROR: could not read directory %s\n", dir);
+		return -1;
+	}
+
+	job.dir = dir;
+	job.count = n;
+	job.next = 0;
+	job.entries = calloc (n ? n : 1, sizeof (struct catalog_entry));
+	pthread_mutex_init (&job.lock, NULL);
+
+	for (i = 0; i < n; i++)
+	{
+		snprintf (job.entries[i].name, sizeof (job.entries[i].name), "%s", ent[i]->d_name);
+		free (ent[i]);
+	}
+	free (ent);
+
+	if (threads <= 0)
+	{
+		threads = sysconf (_SC_NPROCESSORS_ONLN);
+	}
+	if (threads > n)
+	{
+		threads = n;
+	}
+
+	tids = calloc (threads ? threads : 1, sizeof (pthread_t));
+	for (started = 0; started < threads; started++)
+	{
+		if (pthread_create (&tids[started], NULL, catalog_worker, &job))
+		{
+			break;
+		}
+	}
+
+	catalog_worker (&job);	// help out, and do all the work if no thread could be started
+
+	for (i = 0; i < started; i++)
+	{
+		pthread_join (tids[i], NULL);
+	}
+	free (tids);
+	pthread_mutex_destroy (&job.lock);
+
+	printf ("%-32s %-4s %9s  %-16s  %s\n", "File", "Type", "Size", "Time stamp", "Result");
+	for (i = 0; i < n; i++)
+	{
+		struct catalog_entry *e = &job.entries[i];
+
+		memcpy (&t, &e->stamp, sizeof (t));
+		printf ("%-32s %-4s %9lld  %04d-%02d-%02d %02d:%02d  %s\n",
+				e->name,
+				HEADER_P4 == e->header ? "P4" : (HEADER_PT == e->header ? "PT" : "?"),
+				(long long) e->size,
+				t.year + 1980, t.month, t.day, t.hours, t.minutes,
+				e->result ? "FAILED" : "Ok");
+
+		if (e->result)
+		{
+			failed++;
+		}
+	}
+
+	if (catalog_write (dir, job.entries, n))
+	{
+		failed = -1;
+	}
+
+	free (job.entries);
+
+	return failed;
+}
+
+/********************************************************************
+ * Look up a firmware file in the index of its directory
+ *  the entry must match the opened image img (size, modification
+ *  time and inode from its fstat), not whatever path names now
+ * Return:
+ *  0 = found and unchanged since it was checked, entry is filled
+ *  negative = not in the index or changed
+ ********************************************************************/
+int catalog_lookup (const char *path, const struct fw_image *img, struct catalog_entry *entry)
+{
+	char index[PATH_MAX];
+	char line[PATH_MAX + 128];
+	const char *name;
+	unsigned long long ino;
+	long long size;
+	FILE *f;
+	int ret = -1;
+
+	name = strrchr (path, '/');
+	if (name)
+	{
+		snprintf (index, sizeof (index), "%.*s/" CATALOG_INDEX, (int) (name - path), path);
+		name++;
+	}
+	else
+	{
+		snprintf (index, sizeof (index), CATALOG_INDEX);
+		name = path;
+	}
+
+	f = fopen (index, "r");
+	if (NULL == f)
+	{
+		return -1;
+	}
+
+	if (NULL == fgets (line, sizeof (line), f) || strncmp (line, CATALOG_MAGIC, strlen (CATALOG_MAGIC)))
+	{
+		fclose (f);
+		return -1;
+	}
+
+	while (fgets (line, sizeof (line), f))
+	{
+		if (7 != sscanf (line, "%255[^\t]\t%lld\t%lld\t%llu\t%hx\t%d\t%x",
+						 entry->name, &size, &entry->mtime_ns, &ino,
+						 &entry->header, &entry->result, &entry->stamp))
+		{
+			continue;
+		}
+
+		if (strcmp (entry->name, name))
+		{
+			continue;
+		}
+
+		entry->size = size;
+		entry->ino = ino;
+
+		if (entry->size == img->size && entry->mtime_ns == img->mtime_ns && entry->ino == img->ino)
+		{
+			ret = 0;
+		}
+		break;
+	}
+
+	fclose (f);
+
+	return ret;
+}
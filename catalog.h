@@ -0,0 +1,67 @@
+/********************************************************************
+ *
+ * catalog.h -- firmware catalog and validation cache
+ *
+ * Copyright (C) 2013 - 2021 SCS GmbH & Co. KG, Hanau, Germany
+ * written by Peter Mack (peter.mack@scs-ptc.com)
+ *
+ * MIT License
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ *
+ ********************************************************************/
+
+#pragma once
+
+/********************************************************************
+ * Include files
+ ********************************************************************/
+#include <stdint.h>
+#include <sys/types.h>
+
+#include "fwimage.h"
+
+
+/********************************************************************
+ * Defines
+ ********************************************************************/
+#define CATALOG_INDEX	".scsupdate.idx"	// index file in the firmware directory
+#define CATALOG_MAGIC	"# scsupdate catalog 1"
+
+
+/********************************************************************
+ * Types
+ ********************************************************************/
+struct catalog_entry {
+	char name[256];			// file name without directory
+	off_t size;
+	long long mtime_ns;		// modification time in ns
+	ino_t ino;
+	uint16_t header;		// HEADER_P4, HEADER_PT or anything else
+	int result;				// result of dr7check() / ptccheck(), 0 = Ok
+	uint32_t stamp;			// FDTIME stamp, raw
+};
+
+
+/********************************************************************
+ * Function prototypes
+ ********************************************************************/
+int catalog_build (const char *dir, int threads);
+int catalog_lookup (const char *path, const struct fw_image *img, struct catalog_entry *entry);
+int catalog_check_image (const struct fw_image *img);
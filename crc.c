@@ -34,83 +34,368 @@
 #include <stdio.h>
 #include <stdint.h>
 #include <stdlib.h>
+#include <stdbool.h>
 #include <unistd.h>
 #include <limits.h>
+#include <syslog.h>
+#include <pthread.h>
 
 #include "crc.h"
+#include "crctab.h"
 
 
 /********************************************************************
- * Global Variables
+ * Global variables
  ********************************************************************/
-uint32_t crctable[UCHAR_MAX + 1];
-uint32_t crc;
+const struct crc32_backend crc32_backends[] = {
+#if defined(__aarch64__)
+	{"armv8", crc32_armv8, crc32_armv8_supported},
+#endif
+#if defined(__x86_64__) || defined(__i386__)
+	{"pclmul", crc32_pclmul, crc32_pclmul_supported},
+#endif
+	{"table", crc32_slice8, NULL},
+	{NULL, NULL, NULL}
+};
+
+// the portable table kernel is the last entry
+#define CRC32_FALLBACK	(&crc32_backends[sizeof (crc32_backends) / sizeof (crc32_backends[0]) - 2])
+
+static const struct crc32_backend *crc32_active = CRC32_FALLBACK;
 
 
 /********************************************************************
- *
+ * Initialize a CRC context
+ ********************************************************************/
+void crc32_init (struct crc32_ctx *ctx)
+{
+	ctx->crc = CRC_MASK;
+}
+
+/********************************************************************
+ * Portable kernel
+ *  slicing-by-8: eight bytes per step, one table lookup per byte,
+ *  the remaining bytes go through the classic byte table
+ ********************************************************************/
+uint32_t crc32_slice8 (uint32_t crc, const uint8_t *p, size_t len)
+{
+	uint32_t one, two;
+
+	// align to 4 bytes, the compiler turns the loads below into plain moves
+	while (len && ((uintptr_t) p & 3))
+	{
+		UPDATE_CRC(crc, *p++);
+		len--;
+	}
+
+	while (len >= 8)
+	{
+		one = crc ^ ((uint32_t) p[0] | (uint32_t) p[1] << 8 | (uint32_t) p[2] << 16 | (uint32_t) p[3] << 24);
+		two = (uint32_t) p[4] | (uint32_t) p[5] << 8 | (uint32_t) p[6] << 16 | (uint32_t) p[7] << 24;
+
+		crc = crc32_table[7][one & 0xff] ^
+			  crc32_table[6][(one >> 8) & 0xff] ^
+			  crc32_table[5][(one >> 16) & 0xff] ^
+			  crc32_table[4][one >> 24] ^
+			  crc32_table[3][two & 0xff] ^
+			  crc32_table[2][(two >> 8) & 0xff] ^
+			  crc32_table[1][(two >> 16) & 0xff] ^
+			  crc32_table[0][two >> 24];
+
+		p += 8;
+		len -= 8;
+	}
+
+	while (len--)
+	{
+		UPDATE_CRC(crc, *p++);
+	}
+
+	return crc;
+}
+
+/********************************************************************
+ * Feed a buffer into a CRC context
+ ********************************************************************/
+void crc32_update (struct crc32_ctx *ctx, const void *buf, size_t len)
+{
+	ctx->crc = crc32_active->update (ctx->crc, buf, len);
+}
+
+/********************************************************************
+ * Return the final CRC value
+ ********************************************************************/
+uint32_t crc32_final (const struct crc32_ctx *ctx)
+{
+	return ctx->crc ^ CRC_MASK;
+}
+
+/********************************************************************
+ * GF(2) helpers for crc32_combine
+ ********************************************************************/
+#define GF2_DIM	32	// dimension of GF(2) vectors (length of CRC)
+
+static uint32_t gf2_matrix_times (const uint32_t *mat, uint32_t vec)
+{
+	uint32_t sum = 0;
+
+	while (vec)
+	{
+		if (vec & 1)
+		{
+			sum ^= *mat;
+		}
+		vec >>= 1;
+		mat++;
+	}
+
+	return sum;
+}
+
+static void gf2_matrix_square (uint32_t *square, const uint32_t *mat)
+{
+	int n;
+
+	for (n = 0; n < GF2_DIM; n++)
+	{
+		square[n] = gf2_matrix_times (mat, mat[n]);
+	}
+}
+
+/********************************************************************
+ * Combine two final CRC values
+ *  crc1 of block A and crc2 of block B (len2 byte)
+ *  gives the CRC of A followed by B
+ ********************************************************************/
+uint32_t crc32_combine (uint32_t crc1, uint32_t crc2, size_t len2)
+{
+	uint32_t even[GF2_DIM];	// even power of two zeros operator
+	uint32_t odd[GF2_DIM];	// odd power of two zeros operator
+	uint32_t row;
+	int n;
+
+	if (0 == len2)
+	{
+		return crc1;
+	}
+
+	// operator for one zero bit in odd
+	odd[0] = CRCPOLY;
+	row = 1;
+	for (n = 1; n < GF2_DIM; n++)
+	{
+		odd[n] = row;
+		row <<= 1;
+	}
+
+	gf2_matrix_square (even, odd);	// 2 zero bits
+	gf2_matrix_square (odd, even);	// 4 zero bits
+
+	// apply len2 zeros to crc1 (first square puts the operator for one zero byte in even)
+	do
+	{
+		gf2_matrix_square (even, odd);
+		if (len2 & 1)
+		{
+			crc1 = gf2_matrix_times (even, crc1);
+		}
+		len2 >>= 1;
+
+		if (0 == len2)
+		{
+			break;
+		}
+
+		gf2_matrix_square (odd, even);
+		if (len2 & 1)
+		{
+			crc1 = gf2_matrix_times (odd, crc1);
+		}
+		len2 >>= 1;
+	}
+	while (len2);
+
+	return crc1 ^ crc2;
+}
+
+/********************************************************************
+ * Worker thread for crc32_parallel
+ ********************************************************************/
+struct crc32_segment {
+	pthread_t tid;
+	const uint8_t *p;
+	size_t len;
+	uint32_t crc;	// final CRC of this segment
+	bool started;
+};
+
+static void *crc32_worker (void *arg)
+{
+	struct crc32_segment *seg = arg;
+
+	seg->crc = crc32_active->update (CRC_MASK, seg->p, seg->len) ^ CRC_MASK;
+
+	return NULL;
+}
+
+/********************************************************************
+ * CRC of a buffer, split into segments on several threads
+ *  threads <= 0 uses one thread per online CPU
+ *  the result is identical to crc32_init/crc32_update/crc32_final
  ********************************************************************/
-void make_crctable (void)
+uint32_t crc32_parallel (const void *buf, size_t len, int threads)
 {
-	unsigned int i, j;
-	uint32_t r;
+	struct crc32_segment seg[CRC32_MAX_THREADS];
+	const uint8_t *p = buf;
+	size_t seglen;
+	uint32_t crc;
+	int n, i;
+
+	if (threads <= 0)
+	{
+		threads = sysconf (_SC_NPROCESSORS_ONLN);
+	}
+
+	n = len / CRC32_MIN_SEGMENT;
+	if (n > threads)
+	{
+		n = threads;
+	}
+	if (n > CRC32_MAX_THREADS)
+	{
+		n = CRC32_MAX_THREADS;
+	}
 
-	for (i = 0; i <= UCHAR_MAX; i++)
+	if (n <= 1)
 	{
-		r = i;
-		for (j = CHAR_BIT; j > 0; j--)
+		return crc32_active->update (CRC_MASK, p, len) ^ CRC_MASK;
+	}
+
+	// equal segments on 64 byte boundaries, the last one takes the rest
+	seglen = (len / n) & ~(size_t) 63;
+	for (i = 0; i < n; i++)
+	{
+		seg[i].p = p + i * seglen;
+		seg[i].len = (i < n - 1) ? seglen : len - (n - 1) * seglen;
+	}
+
+	for (i = 1; i < n; i++)
+	{
+		seg[i].started = (0 == pthread_create (&seg[i].tid, NULL, crc32_worker, &seg[i]));
+	}
+
+	crc32_worker (&seg[0]);
+	crc = seg[0].crc;
+
+	for (i = 1; i < n; i++)
+	{
+		if (seg[i].started)
 		{
-			if (r & 1)
+			pthread_join (seg[i].tid, NULL);
+		}
+		else
+		{
+			crc32_worker (&seg[i]);		// no thread available, do it here
+		}
+		crc = crc32_combine (crc, seg[i].crc, seg[i].len);
+	}
+
+	return crc;
+}
+
+/********************************************************************
+ * Check a CRC backend against the byte wise UPDATE_CRC loop
+ *  all lengths up to 320 byte and a few larger blocks,
+ *  each at every alignment within 8 byte
+ * Return:
+ *  0 = Ok
+ *  negative = backend computes wrong results
+ ********************************************************************/
+int crc32_check_backend (const struct crc32_backend *b)
+{
+	static const size_t big[] = { 1024, 4093, 4096 };
+	static uint8_t buf[4096 + 8];
+	uint32_t seed = 0x12345678;
+	uint32_t ref, r;
+	size_t len, i;
+	int off;
+
+	for (i = 0; i < sizeof (buf); i++)
+	{
+		seed = seed * 1103515245 + 12345;
+		buf[i] = seed >> 16;
+	}
+
+	for (len = 0; len <= 320 + sizeof (big) / sizeof (big[0]); len++)
+	{
+		size_t n = len <= 320 ? len : big[len - 321];
+
+		for (off = 0; off < 8; off++)
+		{
+			ref = CRC_MASK;
+			for (i = 0; i < n; i++)
 			{
-				r = (r >> 1) ^ CRCPOLY;
+				UPDATE_CRC(ref, buf[off + i]);
 			}
-			else
+
+			r = b->update (CRC_MASK, buf + off, n);
+			if (r != ref)
 			{
-				r >>= 1;
+				syslog (LOG_MAKEPRI (LOG_USER, LOG_ERR), "ERROR: CRC backend %s failed self-test (len %zu, offset %d)", b->name, n, off);
+				return -1;
 			}
 		}
-		crctable[i] = r;
 	}
+
+	return 0;
 }
 
 /********************************************************************
- *
+ * Check every backend this CPU supports
+ * Return:
+ *  number of failed backends
  ********************************************************************/
-uint8_t get_byte (int f)
+int crc32_selftest (void)
 {
-	uint8_t b;
+	const struct crc32_backend *b;
+	int failed = 0;
 
-	if (read (f, &b, 1) < 0)
+	for (b = crc32_backends; b->name; b++)
 	{
-		fprintf (stderr, "ERROR: reading file\n");
+		if ((!b->supported || b->supported ()) && crc32_check_backend (b))
+		{
+			failed++;
+		}
 	}
-	return b;
+
+	return failed;
 }
 
 /********************************************************************
- *
+ * Pick the fastest backend at startup
+ *  the first one in crc32_backends[] the CPU supports and
+ *  that passes the self-test, the table kernel is the fallback
  ********************************************************************/
-uint16_t get_word (int f)
+__attribute__((constructor))
+static void crc32_setup (void)
 {
-	uint16_t b;
+	const struct crc32_backend *b;
 
-	if (read (f, &b, 2) < 0)
+	for (b = crc32_backends; b->name; b++)
 	{
-		fprintf (stderr, "ERROR: reading file\n");
+		if ((!b->supported || b->supported ()) && !crc32_check_backend (b))
+		{
+			break;
+		}
 	}
-	return b;
+
+	crc32_active = b->name ? b : CRC32_FALLBACK;
 }
 
 /********************************************************************
- *
+ * Return the active backend
  ********************************************************************/
-uint32_t get_long (int f)
+const struct crc32_backend *crc32_get_backend (void)
 {
-	uint32_t b;
-
-	if (read (f, &b, 4) < 0)
-	{
-		fprintf (stderr, "ERROR: reading file\n");
-	}
-	return b;
+	return crc32_active;
 }
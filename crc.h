@@ -32,6 +32,7 @@
 /********************************************************************
  * Include files
  ********************************************************************/
+#include <stddef.h>
 #include <stdint.h>
 
 /********************************************************************
@@ -39,12 +40,48 @@
  ********************************************************************/
 #define CRCPOLY			0xEDB88320L
 #define CRC_MASK		0xFFFFFFFFL
-#define UPDATE_CRC(r,c)	r=crctable[((unsigned char)(r)^(unsigned char)(c))&0xff]^(r>>CHAR_BIT)
+#define CRC32_MAX_THREADS	16
+#define CRC32_MIN_SEGMENT	(256 * 1024)	// smaller buffers are not worth a thread
+
+#define UPDATE_CRC(r,c)	r=crc32_table[0][((unsigned char)(r)^(unsigned char)(c))&0xff]^(r>>CHAR_BIT)
+
+/********************************************************************
+ * Types
+ ********************************************************************/
+struct crc32_ctx {
+	uint32_t crc;	// running CRC register (not yet inverted)
+};
+
+struct crc32_backend {
+	const char *name;
+	uint32_t (*update) (uint32_t crc, const uint8_t *p, size_t len);	// works on the raw CRC register
+	int (*supported) (void);	// NULL = always available
+};
+
+/********************************************************************
+ * Global variables
+ ********************************************************************/
+extern const struct crc32_backend crc32_backends[];	// in order of preference, NULL terminated
 
 /********************************************************************
  * Function prototypes
  ********************************************************************/
-void make_crctable (void);
-uint8_t get_byte (int f);
-uint16_t get_word (int f);
-uint32_t get_long (int f);
+void crc32_init (struct crc32_ctx *ctx);
+void crc32_update (struct crc32_ctx *ctx, const void *buf, size_t len);
+uint32_t crc32_final (const struct crc32_ctx *ctx);
+uint32_t crc32_combine (uint32_t crc1, uint32_t crc2, size_t len2);
+uint32_t crc32_parallel (const void *buf, size_t len, int threads);
+const struct crc32_backend *crc32_get_backend (void);
+int crc32_check_backend (const struct crc32_backend *b);
+int crc32_selftest (void);
+
+uint32_t crc32_slice8 (uint32_t crc, const uint8_t *p, size_t len);
+#if defined(__x86_64__) || defined(__i386__)
+int crc32_pclmul_supported (void);
+uint32_t crc32_pclmul (uint32_t crc, const uint8_t *p, size_t len);
+#endif
+#if defined(__aarch64__)
+int crc32_armv8_supported (void);
+uint32_t crc32_armv8 (uint32_t crc, const uint8_t *p, size_t len);
+#endif
+
@@ -0,0 +1,239 @@
+/********************************************************************
+ *
+ * crchw.c -- hardware accelerated CRC kernels
+ *
+ * Copyright (C) 2013 - 2021 SCS GmbH & Co. KG, Hanau, Germany
+ * written by Peter Mack (peter.mack@scs-ptc.com)
+ *
+ * MIT License
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ *
+ ********************************************************************/
+
+
+/********************************************************************
+ * Include files
+ ********************************************************************/
+#include <stdint.h>
+#include <stddef.h>
+#include <string.h>
+#include <limits.h>
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <immintrin.h>
+#endif
+
+#if defined(__aarch64__)
+#include <arm_acle.h>
+#include <sys/auxv.h>
+#ifndef HWCAP_CRC32
+#define HWCAP_CRC32	(1 << 7)
+#endif
+#endif
+
+#include "crc.h"
+
+
+#if defined(__x86_64__) || defined(__i386__)
+/********************************************************************
+ * x86: carry-less multiplication folding
+ *
+ * Folds 64 bytes per step with PCLMULQDQ and reduces the last 128 bit
+ * with a Barrett reduction (Intel: "Fast CRC Computation for Generic
+ * Polynomials Using PCLMULQDQ Instruction"). The constants are for the
+ * bit-reflected CRCPOLY.
+ ********************************************************************/
+int crc32_pclmul_supported (void)
+{
+	__builtin_cpu_init ();
+
+	return __builtin_cpu_supports ("pclmul") && __builtin_cpu_supports ("sse4.1");
+}
+
+__attribute__((target ("pclmul,sse4.1")))
+static uint32_t crc32_pclmul_fold (uint32_t crc, const uint8_t *buf, size_t len)
+{
+	static const uint64_t __attribute__((aligned (16))) k1k2[] = { 0x0154442bd4, 0x01c6e41596 };
+	static const uint64_t __attribute__((aligned (16))) k3k4[] = { 0x01751997d0, 0x00ccaa009e };
+	static const uint64_t __attribute__((aligned (16))) k5k0[] = { 0x0163cd6124, 0x0000000000 };
+	static const uint64_t __attribute__((aligned (16))) poly[] = { 0x01db710641, 0x01f7011641 };
+
+	__m128i x0, x1, x2, x3, x4, x5, x6, x7, x8, y5, y6, y7, y8;
+
+	// len >= 64 and a multiple of 16
+	x1 = _mm_loadu_si128 ((const __m128i *) (buf + 0x00));
+	x2 = _mm_loadu_si128 ((const __m128i *) (buf + 0x10));
+	x3 = _mm_loadu_si128 ((const __m128i *) (buf + 0x20));
+	x4 = _mm_loadu_si128 ((const __m128i *) (buf + 0x30));
+
+	x1 = _mm_xor_si128 (x1, _mm_cvtsi32_si128 (crc));
+
+	x0 = _mm_load_si128 ((const __m128i *) k1k2);
+
+	buf += 64;
+	len -= 64;
+
+	// fold 4 x 128 bit in parallel
+	while (len >= 64)
+	{
+		x5 = _mm_clmulepi64_si128 (x1, x0, 0x00);
+		x6 = _mm_clmulepi64_si128 (x2, x0, 0x00);
+		x7 = _mm_clmulepi64_si128 (x3, x0, 0x00);
+		x8 = _mm_clmulepi64_si128 (x4, x0, 0x00);
+
+		x1 = _mm_clmulepi64_si128 (x1, x0, 0x11);
+		x2 = _mm_clmulepi64_si128 (x2, x0, 0x11);
+		x3 = _mm_clmulepi64_si128 (x3, x0, 0x11);
+		x4 = _mm_clmulepi64_si128 (x4, x0, 0x11);
+
+		y5 = _mm_loadu_si128 ((const __m128i *) (buf + 0x00));
+		y6 = _mm_loadu_si128 ((const __m128i *) (buf + 0x10));
+		y7 = _mm_loadu_si128 ((const __m128i *) (buf + 0x20));
+		y8 = _mm_loadu_si128 ((const __m128i *) (buf + 0x30));
+
+		x1 = _mm_xor_si128 (_mm_xor_si128 (x1, x5), y5);
+		x2 = _mm_xor_si128 (_mm_xor_si128 (x2, x6), y6);
+		x3 = _mm_xor_si128 (_mm_xor_si128 (x3, x7), y7);
+		x4 = _mm_xor_si128 (_mm_xor_si128 (x4, x8), y8);
+
+		buf += 64;
+		len -= 64;
+	}
+
+	// fold into 128 bit
+	x0 = _mm_load_si128 ((const __m128i *) k3k4);
+
+	x5 = _mm_clmulepi64_si128 (x1, x0, 0x00);
+	x1 = _mm_clmulepi64_si128 (x1, x0, 0x11);
+	x1 = _mm_xor_si128 (_mm_xor_si128 (x1, x2), x5);
+
+	x5 = _mm_clmulepi64_si128 (x1, x0, 0x00);
+	x1 = _mm_clmulepi64_si128 (x1, x0, 0x11);
+	x1 = _mm_xor_si128 (_mm_xor_si128 (x1, x3), x5);
+
+	x5 = _mm_clmulepi64_si128 (x1, x0, 0x00);
+	x1 = _mm_clmulepi64_si128 (x1, x0, 0x11);
+	x1 = _mm_xor_si128 (_mm_xor_si128 (x1, x4), x5);
+
+	// single fold of the remaining 16 byte blocks
+	while (len >= 16)
+	{
+		x2 = _mm_loadu_si128 ((const __m128i *) buf);
+
+		x5 = _mm_clmulepi64_si128 (x1, x0, 0x00);
+		x1 = _mm_clmulepi64_si128 (x1, x0, 0x11);
+		x1 = _mm_xor_si128 (_mm_xor_si128 (x1, x2), x5);
+
+		buf += 16;
+		len -= 16;
+	}
+
+	// fold 128 bit to 64 bit
+	x2 = _mm_clmulepi64_si128 (x1, x0, 0x10);
+	x3 = _mm_setr_epi32 (~0, 0, ~0, 0);
+	x1 = _mm_srli_si128 (x1, 8);
+	x1 = _mm_xor_si128 (x1, x2);
+
+	x0 = _mm_loadl_epi64 ((const __m128i *) k5k0);
+
+	x2 = _mm_srli_si128 (x1, 4);
+	x1 = _mm_and_si128 (x1, x3);
+	x1 = _mm_clmulepi64_si128 (x1, x0, 0x00);
+	x1 = _mm_xor_si128 (x1, x2);
+
+	// Barrett reduction to 32 bit
+	x0 = _mm_load_si128 ((const __m128i *) poly);
+
+	x2 = _mm_and_si128 (x1, x3);
+	x2 = _mm_clmulepi64_si128 (x2, x0, 0x10);
+	x2 = _mm_and_si128 (x2, x3);
+	x2 = _mm_clmulepi64_si128 (x2, x0, 0x00);
+	x1 = _mm_xor_si128 (x1, x2);
+
+	return _mm_extract_epi32 (x1, 1);
+}
+
+uint32_t crc32_pclmul (uint32_t crc, const uint8_t *p, size_t len)
+{
+	size_t n;
+
+	if (len >= 64)
+	{
+		n = len & ~(size_t) 15;
+		crc = crc32_pclmul_fold (crc, p, n);
+		p += n;
+		len -= n;
+	}
+
+	return crc32_slice8 (crc, p, len);
+}
+#endif /* __x86_64__ || __i386__ */
+
+
+#if defined(__aarch64__)
+/********************************************************************
+ * ARMv8: CRC32B/CRC32X compute exactly CRCPOLY
+ ********************************************************************/
+int crc32_armv8_supported (void)
+{
+	return (getauxval (AT_HWCAP) & HWCAP_CRC32) != 0;
+}
+
+__attribute__((target ("arch=armv8-a+crc")))
+uint32_t crc32_armv8 (uint32_t crc, const uint8_t *p, size_t len)
+{
+	uint64_t v;
+
+	while (len && ((uintptr_t) p & 7))
+	{
+		crc = __crc32b (crc, *p++);
+		len--;
+	}
+
+	while (len >= 32)
+	{
+		memcpy (&v, p, 8);
+		crc = __crc32d (crc, v);
+		memcpy (&v, p + 8, 8);
+		crc = __crc32d (crc, v);
+		memcpy (&v, p + 16, 8);
+		crc = __crc32d (crc, v);
+		memcpy (&v, p + 24, 8);
+		crc = __crc32d (crc, v);
+		p += 32;
+		len -= 32;
+	}
+
+	while (len >= 8)
+	{
+		memcpy (&v, p, 8);
+		crc = __crc32d (crc, v);
+		p += 8;
+		len -= 8;
+	}
+
+	while (len--)
+	{
+		crc = __crc32b (crc, *p++);
+	}
+
+	return crc;
+}
+#endif /* __aarch64__ */
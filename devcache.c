@@ -0,0 +1,311 @@
+/********************************************************************
+ *
+ * devcache.c -- modem identity cache, keyed by USB port and FTDI serial
+ *
+ * Copyright (C) 2021 SCS GmbH & Co. KG, Hanau, Germany
+ * written by Peter Mack (peter.mack@scs-ptc.com)
+ *
+ * MIT License
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ *
+ ********************************************************************/
+
+
+#define _GNU_SOURCE
+
+/********************************************************************
+ * Include files
+ ********************************************************************/
+#include <stdio.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <limits.h>
+#include <libgen.h>
+#include <inttypes.h>
+#include <pthread.h>
+#include <sys/stat.h>
+
+#include "ptc.h"
+#include "devcache.h"
+
+
+/********************************************************************
+ * Global variables
+ ********************************************************************/
+static pthread_mutex_t devcache_lock = PTHREAD_MUTEX_INITIALIZER;
+
+
+/********************************************************************
+ * Path of the cache file, creates the directories
+ * Return:
+ *  0 = Ok
+ *  negative = Error, no home directory
+ ********************************************************************/
+static int devcache_path (char *path, size_t size)
+{
+	const char *base = getenv ("XDG_CACHE_HOME");
+	char dir[PATH_MAX];
+
+	if (base && *base)
+	{
+		snprintf (dir, sizeof (dir), "%s", base);
+	}
+	else if ((base = getenv ("HOME")) && *base)
+	{
+		snprintf (dir, sizeof (dir), "%s/.cache", base);
+	}
+	else
+	{
+		return -1;
+	}
+
+	mkdir (dir, 0700);
+	strncat (dir, "/" DEVCACHE_DIR, sizeof (dir) - strlen (dir) - 1);
+	mkdir (dir, 0700);
+
+	snprintf (path, size, "%s/" DEVCACHE_FILE, dir);
+
+	return 0;
+}
+
+/********************************************************************
+ * Cache key of a serial port
+ *  USB port path and FTDI serial of the adapter, e.g. "1-2.4/ST123456",
+ *  the same modem on the same port gets the same key across replugs
+ * Return:
+ *  0 = Ok
+ *  negative = not a USB serial port
+ ********************************************************************/
+int devcache_key (const char *tty, char *key, size_t size)
+{
+	char path[PATH_MAX];
+	char real[PATH_MAX];
+	char serial[64] = "-";
+	const char *name;
+	char *usb;
+	FILE *f;
+
+	name = strrchr (tty, '/');
+	name = name ? name + 1 : tty;
+
+	// /sys/class/tty/ttyUSB0/device -> .../1-2.4/1-2.4:1.0/ttyUSB0
+	snprintf (path, sizeof (path), "/sys/class/tty/%s/device", name);
+	if (NULL == realpath (path, real))
+	{
+		return -1;
+	}
+
+	usb = dirname (dirname (real));
+	snprintf (path, sizeof (path), "%s/serial", usb);
+
+	f = fopen (path, "r");
+	if (NULL == f)
+	{
+		return -1;
+	}
+	if (fgets (serial, sizeof (serial), f))
+	{
+		serial[strcspn (serial, "\r\n\t")] = '\0';
+	}
+	fclose (f);
+
+	snprintf (key, size, "%s/%s", basename (usb), serial);
+
+	return 0;
+}
+
+/********************************************************************
+ * Parse one cache line
+ * Return:
+ *  0 = Ok, id filled in
+ *  negative = malformed or unknown modem type
+ ********************************************************************/
+static int devcache_parse (char *line, struct ptc_identity *id)
+{
+	const struct modemtype *m;
+	char *save;
+	char *tok;
+
+	memset (id, 0, sizeof (*id));
+
+	tok = strtok_r (line, "\t\n", &save);		// type
+	m = tok ? PTC_getModemByVer (tok[0]) : NULL;
+	if (NULL == m)
+	{
+		return -1;
+	}
+	id->modem = *m;
+
+	tok = strtok_r (NULL, "\t\n", &save);		// serial number
+	if (NULL == tok)
+	{
+		return -1;
+	}
+	if (strcmp (tok, "-"))
+	{
+		id->sernum = strtoull (tok, NULL, 16);
+		id->has_sernum = true;
+	}
+
+	tok = strtok_r (NULL, "\t\n", &save);		// PACTOR channel
+	if (NULL == tok)
+	{
+		return -1;
+	}
+	id->ptc = atoi (tok);
+
+	while (id->versions < PTC_VERSIONS && (tok = strtok_r (NULL, "\t\n", &save)))
+	{
+		snprintf (id->version[id->versions++], PTC_VERSION_LEN, "%s", tok);
+	}
+
+	return 0;
+}
+
+/********************************************************************
+ * Look up the identity of the modem behind a key
+ * Return:
+ *  0 = found, id filled in
+ *  negative = not cached
+ ********************************************************************/
+int devcache_lookup (const char *key, struct ptc_identity *id)
+{
+	char path[PATH_MAX];
+	char line[DEVCACHE_KEY + PTC_VERSIONS * PTC_VERSION_LEN + 64];
+	size_t len = strlen (key);
+	FILE *f;
+	int ret = -1;
+
+	if (devcache_path (path, sizeof (path)))
+	{
+		return -1;
+	}
+
+	pthread_mutex_lock (&devcache_lock);
+
+	f = fopen (path, "r");
+	if (f)
+	{
+		if (fgets (line, sizeof (line), f) && !strncmp (line, DEVCACHE_MAGIC, strlen (DEVCACHE_MAGIC)))
+		{
+			while (fgets (line, sizeof (line), f))
+			{
+				if (!strncmp (line, key, len) && '\t' == line[len])
+				{
+					ret = devcache_parse (line + len + 1, id);
+					break;
+				}
+			}
+		}
+		fclose (f);
+	}
+
+	pthread_mutex_unlock (&devcache_lock);
+
+	return ret;
+}
+
+/********************************************************************
+ * Record the identity of the modem behind a key
+ *  id = NULL drops the entry, e.g. after an update changed the version,
+ *  the file is written to a temporary file first and renamed
+ * Return:
+ *  0 = Ok
+ *  negative = Error
+ ********************************************************************/
+int devcache_store (const char *key, const struct ptc_identity *id)
+{
+	char path[PATH_MAX];
+	char tmp[PATH_MAX + 16];
+	char line[DEVCACHE_KEY + PTC_VERSIONS * PTC_VERSION_LEN + 64];
+	size_t len = strlen (key);
+	FILE *in;
+	FILE *out;
+	int ret = 0;
+	int i;
+
+	if (devcache_path (path, sizeof (path)))
+	{
+		return -1;
+	}
+	snprintf (tmp, sizeof (tmp), "%s.%d", path, getpid ());
+
+	pthread_mutex_lock (&devcache_lock);
+
+	out = fopen (tmp, "w");
+	if (NULL == out)
+	{
+		pthread_mutex_unlock (&devcache_lock);
+		return -1;
+	}
+
+	fprintf (out, DEVCACHE_MAGIC "\n");
+
+	// keep the entries of all other ports
+	in = fopen (path, "r");
+	if (in)
+	{
+		if (fgets (line, sizeof (line), in) && !strncmp (line, DEVCACHE_MAGIC, strlen (DEVCACHE_MAGIC)))
+		{
+			while (fgets (line, sizeof (line), in))
+			{
+				if (strncmp (line, key, len) || '\t' != line[len])
+				{
+					fputs (line, out);
+				}
+			}
+		}
+		fclose (in);
+	}
+
+	if (id)
+	{
+		fprintf (out, "%s\t%c\t", key, id->modem.ver);
+		if (id->has_sernum)
+		{
+			fprintf (out, "%016" PRIX64, id->sernum);
+		}
+		else
+		{
+			fprintf (out, "-");
+		}
+		fprintf (out, "\t%d", id->ptc);
+		for (i = 0; i < id->versions; i++)
+		{
+			if (!strpbrk (id->version[i], "\t\n"))
+			{
+				fprintf (out, "\t%s", id->version[i]);
+			}
+		}
+		fprintf (out, "\n");
+	}
+
+	if (fclose (out) || rename (tmp, path))
+	{
+		unlink (tmp);
+		ret = -1;
+	}
+
+	pthread_mutex_unlock (&devcache_lock);
+
+	return ret;
+}
@@ -0,0 +1,54 @@
+/********************************************************************
+ *
+ * devcache.h -- modem identity cache, keyed by USB port and FTDI serial
+ *
+ * Copyright (C) 2021 SCS GmbH & Co. KG, Hanau, Germany
+ * written by Peter Mack (peter.mack@scs-ptc.com)
+ *
+ * MIT License
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ *
+ ********************************************************************/
+
+#pragma once
+
+/********************************************************************
+ * Include files
+ ********************************************************************/
+#include <stddef.h>
+
+#include "ptc.h"
+
+
+/********************************************************************
+ * Defines
+ ********************************************************************/
+#define DEVCACHE_DIR	"scsupdate"		// below $XDG_CACHE_HOME or ~/.cache
+#define DEVCACHE_FILE	"devices"
+#define DEVCACHE_MAGIC	"# scsupdate devices 1"
+#define DEVCACHE_KEY	128
+
+
+/********************************************************************
+ * Function prototypes
+ ********************************************************************/
+int devcache_key (const char *tty, char *key, size_t size);
+int devcache_lookup (const char *key, struct ptc_identity *id);
+int devcache_store (const char *key, const struct ptc_identity *id);
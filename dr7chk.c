@@ -34,59 +34,37 @@
 #include <stdio.h>
 #include <stdint.h>
 #include <stdlib.h>
-#include <unistd.h>
-#include <limits.h>
 
 #include "crc.h"
+#include "fwimage.h"
 #include "dr7chk.h"
 
 
-/********************************************************************
- * Defines
- ********************************************************************/
-#define HEADER_P4	0x3450
-
-
-/********************************************************************
- * Global variables
- ********************************************************************/
-extern uint32_t crctable[UCHAR_MAX + 1];
-extern uint32_t crc;
-
-
 /********************************************************************
  * Quick header check
+ *  threads is passed to crc32_parallel(), 0 = one per CPU
  * Return:
  *  0 = Ok
  *  negative = Error
  ********************************************************************/
-int dr7check (int f)
+int dr7check (const struct fw_image *img, int threads)
 {
-	long unsigned int size;
-
-	make_crctable ();
-
-	if (HEADER_P4 != get_word (f))
+	if (HEADER_P4 != img->header)
 	{
-		close (f);
 		fprintf (stderr, "ERROR: Wrong header ID.\n");	// ERROR: file have to start with the P4 header
 		return -1;
 	}
 
-	get_word (f);	// dummy read: number of parts
-
-	// calculate CRC
-	size = get_long (f);
-	lseek (f, 0, SEEK_SET);
-	crc = CRC_MASK;
-	while (size--)
+	// the CRC follows the covered range
+	if (img->length > img->size - 4)
 	{
-		UPDATE_CRC(crc, get_byte (f));
+		fprintf (stderr, "ERROR: file too short.\n");
+		return -2;
 	}
 
-	if ((crc ^ CRC_MASK) != get_long (f))
+	// calculate CRC, split over several threads for large images
+	if (crc32_parallel (img->data, img->length, threads) != fw_get_long (img, img->length))
 	{
-		close (f);
 		fprintf (stderr, "ERROR: wrong CRC.\n");
 		return -2;
 	}
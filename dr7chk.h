@@ -29,7 +29,13 @@
 
 #pragma once
 
+/********************************************************************
+ * Include files
+ ********************************************************************/
+#include "fwimage.h"
+
+
 /********************************************************************
  * Function prototypes
  ********************************************************************/
-int dr7check (int f);
+int dr7check (const struct fw_image *img, int threads);
@@ -0,0 +1,384 @@
+/********************************************************************
+ *
+ * fleet.c -- update all connected modems at once
+ *
+ * Copyright (C) 2021 SCS GmbH & Co. KG, Hanau, Germany
+ * written by Peter Mack (peter.mack@scs-ptc.com)
+ *
+ * MIT License
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ *
+ ********************************************************************/
+
+
+/********************************************************************
+ * Include files
+ ********************************************************************/
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <strings.h>
+#include <inttypes.h>
+#include <dirent.h>
+#include <syslog.h>
+#include <sys/stat.h>
+
+#include "fleet.h"
+#include "serial.h"
+#include "link.h"
+#include "update.h"
+#include "devcache.h"
+
+
+/********************************************************************
+ * Case insensitive search for the first len chars of needle
+ ********************************************************************/
+static bool fleet_contains (const char *haystack, const char *needle, size_t len)
+{
+	if (NULL == haystack || 0 == len)
+	{
+		return false;
+	}
+
+	for (; *haystack; haystack++)
+	{
+		if (!strncasecmp (haystack, needle, len))
+		{
+			return true;
+		}
+	}
+
+	return false;
+}
+
+/********************************************************************
+ * Check a device against the filter
+ *  the filter is a comma separated list, a device matches if
+ *  one entry is part of its model name or is its serial number
+ ********************************************************************/
+static bool fleet_match (const char *filter, const struct fleet_device *d)
+{
+	const char *p = filter;
+	char *end;
+	size_t len;
+
+	if (NULL == filter)
+	{
+		return true;
+	}
+
+	while (*p)
+	{
+		len = strcspn (p, ",");
+
+		if (fleet_contains (d->modem.name, p, len) ||
+			fleet_contains (d->usbtype, p, len) ||
+			(strtoull (p, &end, 16) == d->sernum && end == p + len))
+		{
+			return true;
+		}
+
+		p += len;
+		if (*p == ',')
+		{
+			p++;
+		}
+	}
+
+	return false;
+}
+
+/********************************************************************
+ * Check one candidate file against the extension
+ ********************************************************************/
+static void fleet_candidate (const char *path, const char *ext, char *found, int *n)
+{
+	const char *fext = strrchr (path, '.');
+
+	if (fext && !strcasecmp (fext + 1, ext))
+	{
+		if (0 == (*n)++)
+		{
+			snprintf (found, PATH_MAX, "%s", path);
+		}
+	}
+}
+
+/********************************************************************
+ * Find the firmware for a modem type
+ *  the files given on the command line and the files in the
+ *  directories given there are searched for the extension
+ * Return:
+ *  number of matching files, the first one is in found
+ ********************************************************************/
+static int fleet_firmware (const struct fleet *fl, const char *ext, char *found)
+{
+	char path[PATH_MAX];
+	struct dirent *ep;
+	struct stat st;
+	DIR *dir;
+	int n = 0;
+	int i;
+
+	for (i = 0; i < fl->nfiles; i++)
+	{
+		if (stat (fl->files[i], &st) || !S_ISDIR (st.st_mode))
+		{
+			fleet_candidate (fl->files[i], ext, found, &n);
+			continue;
+		}
+
+		dir = opendir (fl->files[i]);
+		if (NULL == dir)
+		{
+			continue;
+		}
+
+		while ((ep = readdir (dir)))
+		{
+			if (ep->d_name[0] == '.')
+			{
+				continue;
+			}
+			snprintf (path, sizeof (path), "%s/%s", fl->files[i], ep->d_name);
+			fleet_candidate (path, ext, found, &n);
+		}
+
+		closedir (dir);
+	}
+
+	return n;
+}
+
+/********************************************************************
+ * Worker thread: update one device
+ ********************************************************************/
+static void *fleet_worker (void *arg)
+{
+	struct fleet_device *d = arg;
+	const struct fleet *fl = d->fleet;
+	struct progress pg;
+	long long start = timing_now_ns ();
+	struct ptc_identity id;
+	struct ser_port *ser;
+	char key[DEVCACHE_KEY];
+	bool cached = false;
+	int n;
+
+	d->result = -1;
+
+	if (fl->nocache || devcache_key (d->tty, key, sizeof (key)))
+	{
+		key[0] = '\0';
+	}
+	if (key[0] && 0 == devcache_lookup (key, &id))
+	{
+		cached = true;
+		d->modem = id.modem;
+		d->sernum = id.has_sernum ? id.sernum : 0xffffffffffffffff;
+
+		// a known modem outside the filter is not even opened
+		if (!fleet_match (fl->filter, d))
+		{
+			d->result = 1;
+			d->status = "skipped";
+			goto out;
+		}
+	}
+
+	ser = ser_open (d->tty, d->baud);
+	if (NULL == ser)
+	{
+		d->status = "open failed";
+		goto out;
+	}
+
+	if (PTC_wake (ser))
+	{
+		d->status = "no answer";
+		goto close;
+	}
+
+	if (fl->lowlatency)
+	{
+		link_low_latency (ser);
+	}
+
+	if (!cached)
+	{
+		if (PTC_identify (ser, &id))
+		{
+			d->status = "unknown modem";
+			goto close;
+		}
+		if (key[0])
+		{
+			devcache_store (key, &id);
+		}
+		d->modem = id.modem;
+		d->sernum = id.has_sernum ? id.sernum : 0xffffffffffffffff;
+	}
+
+	if (!fleet_match (fl->filter, d))
+	{
+		d->result = 1;
+		d->status = "skipped";
+		goto close;
+	}
+
+	n = fleet_firmware (fl, d->modem.ext, d->fwfile);
+	if (1 != n)
+	{
+		d->fwfile[0] = '\0';
+		d->status = n ? "several firmware files" : "no firmware";
+		goto close;
+	}
+
+	// one progress line per device would be unreadable, the stream tells them apart
+	progress_init (&pg, d->tty, fl->progressfd, fl->progresshz);
+	pg.tty = 0;
+
+	d->result = update (ser, d->modem, d->fwfile, fl->autobaud, NULL, &pg);
+	progress_end (&pg, d->result);
+
+	// a new firmware changes only the version, a failure may mean the entry is stale
+	if (key[0] && 0 == d->result)
+	{
+		id.versions = 0;
+		devcache_store (key, &id);
+	}
+	else if (key[0] && cached && -1 == d->result)
+	{
+		devcache_store (key, NULL);
+	}
+
+	if (0 == d->result)
+	{
+		d->status = "Ok";
+	}
+	else if (-2 == d->result)
+	{
+		d->status = "canceled";
+	}
+	else
+	{
+		d->status = "FAILED";
+	}
+
+close:
+	// the next run opens the modem at its usual speed again
+	if (0 != d->result)
+	{
+		link_restore (ser, d->baud);
+	}
+	ser_close (ser);
+
+out:
+	d->seconds = (timing_now_ns () - start) / 1e9;
+
+	if (d->result < 0)
+	{
+		syslog (LOG_MAKEPRI (LOG_USER, LOG_ERR), "ERROR: update of %s: %s", d->tty, d->status);
+	}
+
+	return NULL;
+}
+
+
+/********************************************************************
+ * Start the update of one device in its own thread
+ *  without a thread the update runs here and is done on return
+ ********************************************************************/
+void fleet_start (const struct fleet *fl, struct fleet_device *d)
+{
+	d->fleet = fl;
+	d->started = (0 == pthread_create (&d->tid, NULL, fleet_worker, d));
+	if (!d->started)
+	{
+		fleet_worker (d);	// no thread available, do it here
+	}
+}
+
+/********************************************************************
+ * One line of the summary table, d = NULL prints the header
+ ********************************************************************/
+void fleet_print (const struct fleet_device *d)
+{
+	const char *fw;
+
+	if (NULL == d)
+	{
+		printf ("\n%-16s %-12s %-16s %-24s %8s  %s\n", "Device", "Modem", "Serial number", "Firmware", "Time", "Result");
+		return;
+	}
+
+	fw = strrchr (d->fwfile, '/');
+	fw = fw ? fw + 1 : d->fwfile;
+
+	printf ("%-16s %-12s %016" PRIX64 " %-24s %7.1fs  %s\n",
+			d->tty,
+			d->modem.name ? d->modem.name : d->usbtype,
+			d->sernum,
+			fw,
+			d->seconds,
+			d->status);
+}
+
+
+/********************************************************************
+ * Update all devices at once, one thread per device
+ *  every worker has its own port, lock file and firmware file,
+ *  a summary table is printed at the end
+ * Return:
+ *  number of failed devices
+ ********************************************************************/
+int fleet_update (struct fleet *fl)
+{
+	struct fleet_device *d;
+	int failed = 0;
+	int i;
+
+	for (i = 0; i < fl->count; i++)
+	{
+		fleet_start (fl, &fl->devs[i]);
+	}
+
+	for (i = 0; i < fl->count; i++)
+	{
+		if (fl->devs[i].started)
+		{
+			pthread_join (fl->devs[i].tid, NULL);
+		}
+	}
+
+	fleet_print (NULL);
+	for (i = 0; i < fl->count; i++)
+	{
+		d = &fl->devs[i];
+		fleet_print (d);
+
+		if (d->result < 0)
+		{
+			failed++;
+		}
+	}
+
+	return failed;
+}
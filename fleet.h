@@ -0,0 +1,84 @@
+/********************************************************************
+ *
+ * fleet.h -- update all connected modems at once
+ *
+ * Copyright (C) 2021 SCS GmbH & Co. KG, Hanau, Germany
+ * written by Peter Mack (peter.mack@scs-ptc.com)
+ *
+ * MIT License
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ *
+ ********************************************************************/
+
+#pragma once
+
+/********************************************************************
+ * Include files
+ ********************************************************************/
+#include <stdint.h>
+#include <stdbool.h>
+#include <limits.h>
+#include <pthread.h>
+
+#include "ptc.h"
+
+
+/********************************************************************
+ * Types
+ ********************************************************************/
+struct fleet;
+
+struct fleet_device {
+	char tty[270];				// the tty device, e.g. /dev/ttyUSB1
+	const char *usbtype;		// name from the USB product ID
+	int baud;
+	// filled in by the worker
+	struct modemtype modem;
+	uint64_t sernum;
+	char fwfile[PATH_MAX];
+	const char *status;			// text for the summary
+	int result;					// 0 = Ok, 1 = skipped, negative = Error
+	double seconds;
+	// worker thread
+	const struct fleet *fleet;
+	pthread_t tid;
+	bool started;
+};
+
+struct fleet {
+	struct fleet_device *devs;
+	int count;
+	char **files;				// firmware files and directories
+	int nfiles;
+	const char *filter;			// model names or serial numbers, NULL = all
+	int autobaud;				// max. baudrate for link_negotiate, 0 = off
+	bool lowlatency;			// FTDI latency timer and ASYNC_LOW_LATENCY
+	int progressfd;				// NDJSON progress stream, -1 = none
+	int progresshz;
+	bool nocache;				// always probe, do not use the device cache
+};
+
+
+/********************************************************************
+ * Function prototypes
+ ********************************************************************/
+int fleet_update (struct fleet *fl);
+void fleet_start (const struct fleet *fl, struct fleet_device *d);
+void fleet_print (const struct fleet_device *d);
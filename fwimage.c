@@ -0,0 +1,192 @@
+/********************************************************************
+ *
+ * fwimage.c -- SCS firmware image file
+ *
+ * Copyright (C) 2013 -2021 SCS GmbH & Co. KG, Hanau, Germany
+ * written by Peter Mack (peter.mack@scs-ptc.com)
+ *
+ * MIT License
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ *
+ ********************************************************************/
+
+
+/********************************************************************
+ * Include files
+ ********************************************************************/
+#include <stdio.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <errno.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#include "fwimage.h"
+
+
+/********************************************************************
+ * Read the whole file into memory
+ *  fallback if the file can not be mapped
+ ********************************************************************/
+static uint8_t *fw_slurp (int f, size_t size)
+{
+	uint8_t *buf;
+	size_t n = 0;
+	ssize_t r;
+
+	buf = malloc (size);
+	if (NULL == buf)
+	{
+		return NULL;
+	}
+
+	while (n < size)
+	{
+		r = read (f, buf + n, size - n);
+		if (r <= 0)
+		{
+			free (buf);
+			return NULL;
+		}
+		n += r;
+	}
+
+	return buf;
+}
+
+/********************************************************************
+ * Open a firmware file, map it and parse the header
+ * Return:
+ *  0 = Ok
+ *  negative = Error
+ ********************************************************************/
+int fw_open (struct fw_image *img, const char *filename)
+{
+	struct stat st;
+	void *p;
+	int f;
+
+	memset (img, 0, sizeof (*img));
+
+	f = open (filename, O_RDONLY);
+	if (-1 == f)
+	{
+		fprintf (stderr, "ERROR: opening file: %s\n", filename);
+		return -1;
+	}
+
+	if (fstat (f, &st) || st.st_size < FW_STAMP_OFFSET + 4)
+	{
+		fprintf (stderr, "ERROR: file too short: %s\n", filename);
+		close (f);
+		return -1;
+	}
+
+	img->size = st.st_size;
+	img->ino = st.st_ino;
+	img->mtime_ns = (long long) st.st_mtim.tv_sec * 1000000000LL + st.st_mtim.tv_nsec;
+
+	p = mmap (NULL, img->size, PROT_READ, MAP_PRIVATE, f, 0);
+	if (MAP_FAILED != p)
+	{
+		// the advice values are not flags, one call each
+		madvise (p, img->size, MADV_SEQUENTIAL);
+		madvise (p, img->size, MADV_WILLNEED);
+		img->data = p;
+		img->mapped = true;
+	}
+	else
+	{
+		img->data = fw_slurp (f, img->size);
+		if (NULL == img->data)
+		{
+			fprintf (stderr, "ERROR: reading file: %s\n", filename);
+			close (f);
+			return -1;
+		}
+	}
+
+	close (f);	// the mapping stays valid
+
+	img->header = fw_get_word (img, 0);
+	if (HEADER_P4 == img->header)
+	{
+		img->parts = fw_get_word (img, 2);
+		img->length = fw_get_long (img, 4);
+	}
+	else
+	{
+		img->length = fw_get_word (img, 2);
+	}
+	memcpy (&img->stamp, img->data + FW_STAMP_OFFSET, sizeof (img->stamp));
+
+	return 0;
+}
+
+/********************************************************************
+ * Release a firmware image
+ ********************************************************************/
+void fw_close (struct fw_image *img)
+{
+	if (img->mapped)
+	{
+		munmap ((void *) img->data, img->size);
+	}
+	else
+	{
+		free ((void *) img->data);
+	}
+
+	img->data = NULL;
+	img->size = 0;
+}
+
+/********************************************************************
+ * Little endian 16 bit value at offset, 0 if outside the image
+ ********************************************************************/
+uint16_t fw_get_word (const struct fw_image *img, size_t offset)
+{
+	const uint8_t *p = img->data + offset;
+
+	if (offset > img->size || img->size - offset < 2)
+	{
+		return 0;
+	}
+
+	return p[0] | p[1] << 8;
+}
+
+/********************************************************************
+ * Little endian 32 bit value at offset, 0 if outside the image
+ ********************************************************************/
+uint32_t fw_get_long (const struct fw_image *img, size_t offset)
+{
+	const uint8_t *p = img->data + offset;
+
+	if (offset > img->size || img->size - offset < 4)
+	{
+		return 0;
+	}
+
+	return (uint32_t) p[0] | (uint32_t) p[1] << 8 | (uint32_t) p[2] << 16 | (uint32_t) p[3] << 24;
+}
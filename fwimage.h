@@ -0,0 +1,81 @@
+/********************************************************************
+ *
+ * fwimage.h -- SCS firmware image file
+ *
+ * Copyright (C) 2013 - 2021 SCS GmbH & Co. KG, Hanau, Germany
+ * written by Peter Mack (peter.mack@scs-ptc.com)
+ *
+ * MIT License
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ *
+ ********************************************************************/
+
+#pragma once
+
+/********************************************************************
+ * Include files
+ ********************************************************************/
+#include <stddef.h>
+#include <stdint.h>
+#include <stdbool.h>
+
+
+/********************************************************************
+ * Defines
+ ********************************************************************/
+#define HEADER_P4	0x3450		// P4dragon firmware
+#define HEADER_PT	0xEA60		// PTC firmware
+
+#define FW_STAMP_OFFSET	12		// offset of the FDTIME stamp
+
+
+/********************************************************************
+ * Types
+ ********************************************************************/
+typedef struct _FDTIME
+{
+	unsigned int twosecs :5;
+	unsigned int minutes :6;
+	unsigned int hours :5;
+	unsigned int day :5;
+	unsigned int month :4;
+	unsigned int year :7;	// = year - 1980
+} FDTIME;
+
+struct fw_image {
+	const uint8_t *data;	// whole file content
+	size_t size;			// file length
+	uint64_t ino;			// inode of the opened file
+	long long mtime_ns;		// modification time of the opened file in ns
+	bool mapped;			// data is mmap()ed, otherwise malloc()ed
+	uint16_t header;		// HEADER_P4 or HEADER_PT
+	uint16_t parts;			// number of parts (P4 only)
+	uint32_t length;		// number of bytes covered by the CRC
+	FDTIME stamp;			// firmware time stamp
+};
+
+
+/********************************************************************
+ * Function prototypes
+ ********************************************************************/
+int fw_open (struct fw_image *img, const char *filename);
+void fw_close (struct fw_image *img);
+uint16_t fw_get_word (const struct fw_image *img, size_t offset);
+uint32_t fw_get_long (const struct fw_image *img, size_t offset);
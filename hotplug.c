@@ -0,0 +1,357 @@
+/********************************************************************
+ *
+ * hotplug.c -- update every SCS modem that is plugged in
+ *
+ * Copyright (C) 2021 SCS GmbH & Co. KG, Hanau, Germany
+ * written by Peter Mack (peter.mack@scs-ptc.com)
+ *
+ * MIT License
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ *
+ ********************************************************************/
+
+
+#define _GNU_SOURCE
+
+/********************************************************************
+ * Include files
+ ********************************************************************/
+#include <errno.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <limits.h>
+#include <poll.h>
+#include <syslog.h>
+#include <pthread.h>
+#include <sys/time.h>
+#include <sys/inotify.h>
+
+#include "serial.h"
+#include "usbdev.h"
+#include "hotplug.h"
+
+
+/********************************************************************
+ * Types
+ ********************************************************************/
+enum hotplug_state {
+	SLOT_FREE,
+	SLOT_WAIT,			// plugged in, waiting for the tty
+	SLOT_RUN,			// update running
+	SLOT_DONE			// result printed, waiting for the unplug
+};
+
+struct hotplug_slot {
+	struct fleet_device dev;
+	enum hotplug_state state;
+	char iface[PATH_MAX];		// sysfs directory of the interface
+	long long since;			// plugged in, ser_now_ms() base
+	bool gone;					// unplugged during the update
+};
+
+struct hotplug {
+	const struct fleet *fleet;
+	struct hotplug_slot slot[HOTPLUG_MAX];
+	int failed;
+};
+
+
+/********************************************************************
+ * Slot of an interface, iface = NULL finds a free slot
+ * Return:
+ *  the slot, NULL = not found
+ ********************************************************************/
+static struct hotplug_slot *hotplug_find (struct hotplug *hp, const char *iface)
+{
+	struct hotplug_slot *s;
+	int i;
+
+	for (i = 0; i < HOTPLUG_MAX; i++)
+	{
+		s = &hp->slot[i];
+		if (iface ? (SLOT_FREE != s->state && !strcmp (s->iface, iface)) : SLOT_FREE == s->state)
+		{
+			return s;
+		}
+	}
+
+	return NULL;
+}
+
+/********************************************************************
+ * libusb hotplug callback
+ *  runs inside libusb_handle_events(), so it only takes note
+ *  of the device, the tty usually does not exist yet
+ * Return:
+ *  0 = keep the callback
+ ********************************************************************/
+static int hotplug_event (libusb_context *ctx, libusb_device *dev, libusb_hotplug_event event, void *arg)
+{
+	struct hotplug *hp = arg;
+	struct libusb_device_descriptor desc;
+	struct hotplug_slot *s;
+	char iface[PATH_MAX];
+
+	libusb_get_device_descriptor (dev, &desc);
+	if (!SCS_USB_MATCH (desc.idVendor, desc.idProduct) || usb_iface_path (dev, iface, sizeof (iface)))
+	{
+		return 0;
+	}
+
+	s = hotplug_find (hp, iface);
+
+	if (LIBUSB_HOTPLUG_EVENT_DEVICE_LEFT == event)
+	{
+		if (NULL == s)
+		{
+			return 0;
+		}
+
+		// a running update notices it on its own
+		if (SLOT_RUN == s->state)
+		{
+			s->gone = true;
+		}
+		else
+		{
+			printf ("%s removed\n", s->dev.usbtype);
+			s->state = SLOT_FREE;
+		}
+		return 0;
+	}
+
+	if (s)
+	{
+		return 0;
+	}
+
+	s = hotplug_find (hp, NULL);
+	if (NULL == s)
+	{
+		fprintf (stderr, "ERROR: more than %d updates at the same time\n", HOTPLUG_MAX);
+		return 0;
+	}
+
+	memset (&s->dev, 0, sizeof (s->dev));
+	s->dev.usbtype = modems[SCS_USB_TYPE (desc.idProduct)].type;
+	s->dev.baud = modems[SCS_USB_TYPE (desc.idProduct)].baud;
+	s->dev.status = "not started";
+	snprintf (s->iface, sizeof (s->iface), "%s", iface);
+	s->since = ser_now_ms ();
+	s->gone = false;
+	s->state = SLOT_WAIT;
+
+	printf ("%s plugged in\n", s->dev.usbtype);
+
+	return 0;
+}
+
+/********************************************************************
+ * Start the update of every new device whose tty is ready
+ * Return:
+ *  number of devices still waiting for their tty
+ ********************************************************************/
+static int hotplug_start (struct hotplug *hp)
+{
+	struct hotplug_slot *s;
+	int waiting = 0;
+	int i;
+
+	for (i = 0; i < HOTPLUG_MAX; i++)
+	{
+		s = &hp->slot[i];
+		if (SLOT_WAIT != s->state)
+		{
+			continue;
+		}
+
+		// udev creates the node and then sets its owner and mode
+		if (0 == usb_iface_tty (s->iface, s->dev.tty, sizeof (s->dev.tty))
+			&& 0 == access (s->dev.tty, R_OK | W_OK))
+		{
+			printf ("%s on %s: updating\n", s->dev.usbtype, s->dev.tty);
+			s->state = SLOT_RUN;
+			fleet_start (hp->fleet, &s->dev);
+		}
+		else if (ser_now_ms () - s->since > HOTPLUG_TTY_MS)
+		{
+			fprintf (stderr, "ERROR: no usable tty for %s at %s\n", s->dev.usbtype, s->iface);
+			syslog (LOG_MAKEPRI (LOG_USER, LOG_ERR), "ERROR: no usable tty at %s", s->iface);
+			hp->failed++;
+			s->state = SLOT_DONE;
+		}
+		else
+		{
+			waiting++;
+		}
+	}
+
+	return waiting;
+}
+
+/********************************************************************
+ * Report finished updates and free their slots
+ *  wait = true waits for the running ones
+ ********************************************************************/
+static void hotplug_reap (struct hotplug *hp, bool wait)
+{
+	struct hotplug_slot *s;
+	int i;
+
+	for (i = 0; i < HOTPLUG_MAX; i++)
+	{
+		s = &hp->slot[i];
+		if (SLOT_RUN != s->state)
+		{
+			continue;
+		}
+
+		if (s->dev.started)
+		{
+			if (wait)
+			{
+				pthread_join (s->dev.tid, NULL);
+			}
+			else if (pthread_tryjoin_np (s->dev.tid, NULL))
+			{
+				continue;
+			}
+		}
+
+		fleet_print (&s->dev);
+		if (s->dev.result < 0)
+		{
+			hp->failed++;
+		}
+
+		// the slot stays taken until the modem is unplugged
+		s->state = s->gone ? SLOT_FREE : SLOT_DONE;
+	}
+}
+
+/********************************************************************
+ * Update every SCS modem that is plugged in until *run is 0
+ *  modems already plugged in at the start are updated as well,
+ *  each one gets the file of its type as with fleet_update(),
+ *  running updates are finished before it returns
+ * Return:
+ *  number of failed updates
+ *  negative = Error, no hotplug support
+ ********************************************************************/
+int hotplug_run (struct fleet *fl, volatile int *run)
+{
+	struct hotplug *hp;
+	libusb_hotplug_callback_handle handle;
+	libusb_context *ctx;
+	struct pollfd pfd;
+	struct timeval tv;
+	char buf[4096];
+	int waiting = 0;
+	int err;
+
+	err = libusb_init (&ctx);
+	if (err)
+	{
+		fprintf (stderr, "ERROR: unable to initialize libusb: %i\n", err);
+		return -1;
+	}
+
+	if (!libusb_has_capability (LIBUSB_CAP_HAS_HOTPLUG))
+	{
+		fprintf (stderr, "ERROR: libusb has no hotplug support\n");
+		libusb_exit (ctx);
+		return -1;
+	}
+
+	hp = calloc (1, sizeof (struct hotplug));
+	if (NULL == hp)
+	{
+		fprintf (stderr, "ERROR: hotplug - %s\n", strerror (errno));
+		libusb_exit (ctx);
+		return -1;
+	}
+	hp->fleet = fl;
+
+	// wakes us up as soon as the tty node appears or gets its mode
+	pfd.fd = inotify_init1 (IN_NONBLOCK | IN_CLOEXEC);
+	pfd.events = POLLIN;
+	if (pfd.fd >= 0)
+	{
+		inotify_add_watch (pfd.fd, "/dev", IN_CREATE | IN_ATTRIB);
+	}
+
+	err = libusb_hotplug_register_callback (ctx,
+			LIBUSB_HOTPLUG_EVENT_DEVICE_ARRIVED | LIBUSB_HOTPLUG_EVENT_DEVICE_LEFT,
+			LIBUSB_HOTPLUG_ENUMERATE, SCS_USB_VID, LIBUSB_HOTPLUG_MATCH_ANY,
+			LIBUSB_HOTPLUG_MATCH_ANY, hotplug_event, hp, &handle);
+	if (LIBUSB_SUCCESS != err)
+	{
+		fprintf (stderr, "ERROR: libusb hotplug: %s\n", libusb_error_name (err));
+		if (pfd.fd >= 0)
+		{
+			close (pfd.fd);
+		}
+		libusb_exit (ctx);
+		free (hp);
+		return -1;
+	}
+
+	printf ("Waiting for SCS modems, stop with Ctrl-C\n");
+	syslog (LOG_MAKEPRI (LOG_USER, LOG_INFO), "Waiting for SCS modems");
+
+	while (*run)
+	{
+		// do not block in libusb while a tty is due
+		tv.tv_sec = 0;
+		tv.tv_usec = waiting ? 0 : HOTPLUG_POLL_MS * 1000;
+		libusb_handle_events_timeout_completed (ctx, &tv, NULL);
+
+		waiting = hotplug_start (hp);
+		hotplug_reap (hp, false);
+
+		if (waiting)
+		{
+			if (pfd.fd < 0 || poll (&pfd, 1, HOTPLUG_POLL_MS) <= 0)
+			{
+				continue;
+			}
+			while (read (pfd.fd, buf, sizeof (buf)) > 0)
+			{
+			}
+		}
+	}
+
+	printf ("Waiting for the running updates\n");
+	hotplug_reap (hp, true);
+
+	libusb_hotplug_deregister_callback (ctx, handle);
+	libusb_exit (ctx);
+	if (pfd.fd >= 0)
+	{
+		close (pfd.fd);
+	}
+
+	err = hp->failed;
+	free (hp);
+
+	return err;
+}
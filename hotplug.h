@@ -0,0 +1,49 @@
+/********************************************************************
+ *
+ * hotplug.h -- update every SCS modem that is plugged in
+ *
+ * Copyright (C) 2021 SCS GmbH & Co. KG, Hanau, Germany
+ * written by Peter Mack (peter.mack@scs-ptc.com)
+ *
+ * MIT License
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ *
+ ********************************************************************/
+
+#pragma once
+
+/********************************************************************
+ * Include files
+ ********************************************************************/
+#include "fleet.h"
+
+
+/********************************************************************
+ * Defines
+ ********************************************************************/
+#define HOTPLUG_MAX			16		// updates at the same time
+#define HOTPLUG_POLL_MS		250		// max. time to notice the stop flag
+#define HOTPLUG_TTY_MS		5000	// max. wait for the tty after plug in
+
+
+/********************************************************************
+ * Function prototypes
+ ********************************************************************/
+int hotplug_run (struct fleet *fl, volatile int *run);
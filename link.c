@@ -0,0 +1,297 @@
+/********************************************************************
+ *
+ * link.c -- link quality probe and baudrate negotiation
+ *
+ * Copyright (C) 2021 SCS GmbH & Co. KG, Hanau, Germany
+ * written by Peter Mack (peter.mack@scs-ptc.com)
+ *
+ * MIT License
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ *
+ ********************************************************************/
+
+/********************************************************************
+ * Include files
+ ********************************************************************/
+#include <stdio.h>
+#include <string.h>
+#include <syslog.h>
+
+#include "serial.h"
+#include "ptc.h"
+#include "link.h"
+
+
+/********************************************************************
+ * Global variables
+ ********************************************************************/
+static const int link_rates[] = {
+	38400, 57600, 115200, 230400, 460800, 921600
+};
+
+
+/********************************************************************
+ * Measure round trip time and error rate with empty commands
+ *
+ *  Return 0 = Ok, all round trips valid
+ *        -1 = at least one round trip failed
+ ********************************************************************/
+int link_probe (struct ser_port *ser, int rounds, struct link_quality *q)
+{
+	long long t;
+	double ms, sum = 0;
+	int i;
+
+	q->rounds = rounds;
+	q->errors = 0;
+	q->rtt_avg_ms = 0;
+	q->rtt_max_ms = 0;
+
+	for (i = 0; i < rounds; i++)
+	{
+		t = timing_now_ns ();
+		if (PTC_cmd (ser, "\r", 1))
+		{
+			q->errors++;
+			ser_flush (ser);	// throw away the garbage
+			continue;
+		}
+		ms = (timing_now_ns () - t) / 1e6;
+
+		sum += ms;
+		if (ms > q->rtt_max_ms)
+		{
+			q->rtt_max_ms = ms;
+		}
+	}
+
+	if (q->rounds > q->errors)
+	{
+		q->rtt_avg_ms = sum / (q->rounds - q->errors);
+	}
+
+	return q->errors ? -1 : 0;
+}
+
+
+/********************************************************************
+ * Tell the modem a new speed and follow with the port
+ *  the modem confirms at the old speed, then switches
+ *
+ *  Return 0 = Ok
+ *        -1 = no confirmation or the port cannot follow
+ ********************************************************************/
+static int link_serb (struct ser_port *ser, int baud)
+{
+	char cmd[24];
+	int n;
+
+	n = snprintf (cmd, sizeof (cmd), SERBAUD_CMD, baud);
+	if (ser_write_all (ser, cmd, n, SER_TIMEOUT_MS) || ser_wait (ser, CMDSTR))
+	{
+		return -1;
+	}
+
+	if (ser_set_baud (ser, baud))
+	{
+		return -1;
+	}
+	ser_flush (ser);
+
+	return 0;
+}
+
+/********************************************************************
+ * Switch modem and port to a new speed and probe the link
+ *  the switch only counts if every probe round trip echoes at the
+ *  new speed, q tells how many did
+ *
+ *  Return 0 = Ok
+ *        -1 = link not usable at this speed, port and modem may
+ *             be at either speed
+ ********************************************************************/
+static int link_switch (struct ser_port *ser, int baud, struct link_quality *q)
+{
+	q->baud = baud;
+	q->rounds = 0;
+	q->errors = 0;
+
+	if (link_serb (ser, baud))
+	{
+		return -1;
+	}
+
+	return link_probe (ser, LINK_ROUNDS, q);
+}
+
+/********************************************************************
+ * Get back to the last good speed after a failed switch
+ *  first the port alone goes back, in case the modem never switched,
+ *  the modem is only told to go back at the failed speed if some
+ *  probe round trips made it there, nothing is sent at a speed
+ *  that did not carry a single one
+ *
+ *  Return 0 = Ok, modem answers at baud
+ *        -1 = the modem is lost
+ ********************************************************************/
+static int link_revert (struct ser_port *ser, int baud, const struct link_quality *failed)
+{
+	if (0 == ser_set_baud (ser, baud))
+	{
+		ser_flush (ser);
+		if (0 == PTC_cmd (ser, "\r", 1))
+		{
+			return 0;
+		}
+	}
+
+	if (failed->errors >= failed->rounds || ser_set_baud (ser, failed->baud))
+	{
+		return -1;
+	}
+	ser_flush (ser);
+
+	if (link_serb (ser, baud))
+	{
+		return -1;
+	}
+
+	return PTC_cmd (ser, "\r", 1) ? -1 : 0;
+}
+
+
+/********************************************************************
+ * Print the result of a probe
+ ********************************************************************/
+static void link_report (const char *what, const struct link_quality *q)
+{
+	printf ("%-9s %7d baud: RTT avg %6.2f ms, max %6.2f ms, %d/%d errors\n",
+			what, q->baud, q->rtt_avg_ms, q->rtt_max_ms, q->errors, q->rounds);
+	syslog (LOG_MAKEPRI (LOG_USER, LOG_INFO), "Link %s %d baud: RTT avg %.2f ms, max %.2f ms, %d/%d errors",
+			what, q->baud, q->rtt_avg_ms, q->rtt_max_ms, q->errors, q->rounds);
+}
+
+
+/********************************************************************
+ * Switch the port to low latency mode
+ *  the effect shows in the transfer rate update() reports
+ *
+ *  Return 0 = Ok
+ *        -1 = nothing changed
+ ********************************************************************/
+int link_low_latency (struct ser_port *ser)
+{
+	if (ser_low_latency (ser))
+	{
+		return -1;
+	}
+
+	printf ("%s: low latency mode\n", ser->name);
+
+	return 0;
+}
+
+
+/********************************************************************
+ * Step up to the highest speed the link handles without errors
+ *  starts at baud, tries every known rate up to maxbaud and falls
+ *  back to the last good one at the first failure
+ *
+ *  Return the speed in use
+ *         -1 = the link is lost
+ ********************************************************************/
+int link_negotiate (struct ser_port *ser, int baud, int maxbaud, struct link_quality *q)
+{
+	struct link_quality t;
+	int i;
+
+	q->baud = baud;
+	if (NULL == ser->ops->set_speed)
+	{
+		printf ("The speed of %s cannot be changed.\n", ser->name);
+		link_probe (ser, LINK_ROUNDS, q);
+		return baud;
+	}
+
+	if (link_probe (ser, LINK_ROUNDS, q))
+	{
+		link_report ("Unstable", q);
+		return baud;	// do not make things worse
+	}
+	link_report ("Start", q);
+
+	for (i = 0; i < sizeof (link_rates) / sizeof (link_rates[0]); i++)
+	{
+		if (link_rates[i] <= baud || link_rates[i] > maxbaud)
+		{
+			continue;
+		}
+
+		if (0 == link_switch (ser, link_rates[i], &t))
+		{
+			link_report ("Ok", &t);
+			*q = t;
+			baud = t.baud;
+			continue;
+		}
+		link_report ("Failed", &t);
+
+		if (link_revert (ser, baud, &t))
+		{
+			fprintf (stderr, "ERROR: lost the modem while falling back to %d baud!\n", baud);
+			syslog (LOG_MAKEPRI (LOG_USER, LOG_ERR), "ERROR: lost the modem while falling back to %d baud", baud);
+			return -1;
+		}
+		break;
+	}
+
+	link_report ("Using", q);
+
+	return baud;
+}
+
+
+/********************************************************************
+ * Set the modem back to the speed it had before link_negotiate()
+ *  for every end that is not a completed update, the next run
+ *  opens the port at the original speed again
+ *
+ *  Return 0 = Ok, modem answers at baud
+ *        -1 = the modem did not take it
+ ********************************************************************/
+int link_restore (struct ser_port *ser, int baud)
+{
+	if (ser->baud == baud)
+	{
+		return 0;
+	}
+
+	ser_flush (ser);
+	if (link_serb (ser, baud) || PTC_cmd (ser, "\r", 1))
+	{
+		fprintf (stderr, "ERROR: could not set the modem on %s back to %d baud!\n", ser->name, baud);
+		syslog (LOG_MAKEPRI (LOG_USER, LOG_ERR), "ERROR: could not set the modem back to %d baud", baud);
+		return -1;
+	}
+
+	printf ("%s: back to %d baud\n", ser->name, baud);
+
+	return 0;
+}
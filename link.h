@@ -0,0 +1,64 @@
+/********************************************************************
+ *
+ * link.h -- link quality probe and baudrate negotiation
+ *
+ * Copyright (C) 2021 SCS GmbH & Co. KG, Hanau, Germany
+ * written by Peter Mack (peter.mack@scs-ptc.com)
+ *
+ * MIT License
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ *
+ ********************************************************************/
+
+#pragma once
+
+/********************************************************************
+ * Include files
+ ********************************************************************/
+#include "serial.h"
+
+
+/********************************************************************
+ * Defines
+ ********************************************************************/
+#define LINK_ROUNDS		8			// command round trips per probe
+#define LINK_MAX_BAUD	921600		// default upper limit for negotiation
+#define SERBAUD_CMD		"serb %d\r"	// set the serial speed of the modem
+
+
+/********************************************************************
+ * Types
+ ********************************************************************/
+struct link_quality {
+	int baud;
+	int rounds;			// round trips tried
+	int errors;			// round trips without a valid prompt
+	double rtt_avg_ms;	// average round trip time of the valid ones
+	double rtt_max_ms;
+};
+
+
+/********************************************************************
+ * Function prototypes
+ ********************************************************************/
+int link_probe (struct ser_port *ser, int rounds, struct link_quality *q);
+int link_negotiate (struct ser_port *ser, int baud, int maxbaud, struct link_quality *q);
+int link_low_latency (struct ser_port *ser);
+int link_restore (struct ser_port *ser, int baud);
@@ -0,0 +1,180 @@
+/********************************************************************
+ *
+ * match.c -- streaming multi-pattern matcher (Aho-Corasick)
+ *
+ * Copyright (C) 2021 SCS GmbH & Co. KG, Hanau, Germany
+ * written by Peter Mack (peter.mack@scs-ptc.com)
+ *
+ * MIT License
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ *
+ ********************************************************************/
+
+/********************************************************************
+ * Include files
+ ********************************************************************/
+#include <stdint.h>
+
+#include "match.h"
+
+
+/********************************************************************
+ * Child of node n for char c
+ *  Return node, -1 = none
+ ********************************************************************/
+static int match_child (const struct match_set *m, int n, char c)
+{
+	int k;
+
+	for (k = m->node[n].child; k >= 0; k = m->node[k].sibling)
+	{
+		if (m->node[k].c == c)
+		{
+			return k;
+		}
+	}
+
+	return -1;
+}
+
+
+/********************************************************************
+ * Build the automaton for a set of patterns
+ *  a leading MATCH_LINE anchors a pattern at the start of a line,
+ *  if two patterns end at the same char the longer one wins
+ *
+ *  Return 0 = Ok
+ *        -1 = too many patterns or too long
+ ********************************************************************/
+int match_init (struct match_set *m, const char *const *patterns, int count)
+{
+	int16_t queue[MATCH_NODES];
+	int head = 0, tail = 0;
+	const char *p;
+	int i, n, k, f;
+
+	if (count > MATCH_MAX)
+	{
+		return -1;
+	}
+
+	m->nodes = 1;
+	m->count = count;
+	m->node[0].c = 0;
+	m->node[0].child = -1;
+	m->node[0].sibling = -1;
+	m->node[0].fail = 0;
+	m->node[0].out = -1;
+
+	// trie
+	for (i = 0; i < count; i++)
+	{
+		m->line[i] = (MATCH_LINE == patterns[i][0]);
+
+		n = 0;
+		for (p = patterns[i]; *p; p++)
+		{
+			k = match_child (m, n, *p);
+			if (k < 0)
+			{
+				if (m->nodes == MATCH_NODES)
+				{
+					return -1;
+				}
+				k = m->nodes++;
+				m->node[k].c = *p;
+				m->node[k].child = -1;
+				m->node[k].sibling = m->node[n].child;
+				m->node[k].fail = 0;
+				m->node[k].out = -1;
+				m->node[n].child = k;
+			}
+			n = k;
+		}
+
+		if (m->node[n].out < 0)
+		{
+			m->node[n].out = i;
+		}
+	}
+
+	// failure links breadth first, a suffix is always done before the node
+	for (k = m->node[0].child; k >= 0; k = m->node[k].sibling)
+	{
+		queue[tail++] = k;
+	}
+
+	while (head < tail)
+	{
+		n = queue[head++];
+		if (m->node[n].out < 0)
+		{
+			m->node[n].out = m->node[m->node[n].fail].out;
+		}
+
+		for (k = m->node[n].child; k >= 0; k = m->node[k].sibling)
+		{
+			f = m->node[n].fail;
+			while (f && match_child (m, f, m->node[k].c) < 0)
+			{
+				f = m->node[f].fail;
+			}
+			f = match_child (m, f, m->node[k].c);
+			m->node[k].fail = (f > 0 && f != k) ? f : 0;
+			queue[tail++] = k;
+		}
+	}
+
+	return 0;
+}
+
+
+/********************************************************************
+ * State at the start of a line
+ ********************************************************************/
+int match_start (const struct match_set *m)
+{
+	int state = 0;
+
+	match_step (m, &state, MATCH_LINE);
+
+	return state;
+}
+
+
+/********************************************************************
+ * Feed one char
+ *
+ *  Return index of the pattern that ends with this char
+ *         -1 = none
+ ********************************************************************/
+int match_step (const struct match_set *m, int *state, char c)
+{
+	int n = *state;
+	int k;
+
+	while ((k = match_child (m, n, c)) < 0 && n)
+	{
+		n = m->node[n].fail;
+	}
+	*state = k < 0 ? 0 : k;
+
+	return m->node[*state].out;
+}
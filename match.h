@@ -0,0 +1,70 @@
+/********************************************************************
+ *
+ * match.h -- streaming multi-pattern matcher (Aho-Corasick)
+ *
+ * Copyright (C) 2021 SCS GmbH & Co. KG, Hanau, Germany
+ * written by Peter Mack (peter.mack@scs-ptc.com)
+ *
+ * MIT License
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ *
+ ********************************************************************/
+
+#pragma once
+
+/********************************************************************
+ * Include files
+ ********************************************************************/
+#include <stdint.h>
+
+
+/********************************************************************
+ * Defines
+ ********************************************************************/
+#define MATCH_MAX		16		// patterns per set
+#define MATCH_NODES		192		// trie nodes per set, sum of the pattern lengths + 1
+#define MATCH_LINE		'\n'	// leading char of a pattern anchored at the start of a line
+
+
+/********************************************************************
+ * Types
+ ********************************************************************/
+struct match_node {
+	char c;					// edge from the parent
+	int16_t child;			// first child, -1 = none
+	int16_t sibling;		// next child of the parent, -1 = none
+	int16_t fail;			// longest proper suffix that is a trie node
+	int16_t out;			// pattern ending here or at a suffix, -1 = none
+};
+
+struct match_set {
+	struct match_node node[MATCH_NODES];
+	int nodes;
+	int count;
+	uint8_t line[MATCH_MAX];	// pattern is anchored at a line start
+};
+
+
+/********************************************************************
+ * Function prototypes
+ ********************************************************************/
+int match_init (struct match_set *m, const char *const *patterns, int count);
+int match_start (const struct match_set *m);
+int match_step (const struct match_set *m, int *state, char c);
@@ -0,0 +1,281 @@
+/********************************************************************
+ *
+ * progress.c -- rate limited progress display and event stream
+ *
+ * Copyright (C) 2021 SCS GmbH & Co. KG, Hanau, Germany
+ * written by Peter Mack (peter.mack@scs-ptc.com)
+ *
+ * MIT License
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ *
+ ********************************************************************/
+
+
+/********************************************************************
+ * Include files
+ ********************************************************************/
+#include <stdio.h>
+#include <string.h>
+#include <errno.h>
+#include <unistd.h>
+#include <poll.h>
+
+#include "progress.h"
+#include "timing.h"
+
+
+/********************************************************************
+ * Send one line to the event stream
+ *  a full stream drops the whole event, a line that is started is
+ *  finished (or the stream is switched off after PROGRESS_STALL_MS),
+ *  so the reader never gets half a line,
+ *  a reader that went away switches the stream off,
+ *  the update itself must go on
+ ********************************************************************/
+static void progress_emit (struct progress *pg, const char *line, int len)
+{
+	struct pollfd pfd;
+	int sent = 0;
+	int r;
+
+	while (sent < len)
+	{
+		r = write (pg->fd, line + sent, len - sent);
+		if (r >= 0)
+		{
+			sent += r;
+			continue;
+		}
+		if (errno == EINTR)
+		{
+			continue;
+		}
+		if (errno == EAGAIN && 0 == sent)
+		{
+			return;		// drop this event
+		}
+
+		pfd.fd = pg->fd;
+		pfd.events = POLLOUT;
+		if (errno != EAGAIN || poll (&pfd, 1, PROGRESS_STALL_MS) <= 0)
+		{
+			pg->fd = -1;
+			return;
+		}
+	}
+}
+
+/********************************************************************
+ * Copy a string as the contents of a JSON string
+ *  quote, backslash and control chars are escaped
+ ********************************************************************/
+static void progress_escape (char *dst, size_t size, const char *src)
+{
+	size_t n = 0;
+
+	for (; *src && n + 7 < size; src++)
+	{
+		if ('"' == *src || '\\' == *src)
+		{
+			dst[n++] = '\\';
+			dst[n++] = *src;
+		}
+		else if ((unsigned char) *src < 0x20)
+		{
+			n += snprintf (dst + n, size - n, "\\u%04x", (unsigned char) *src);
+		}
+		else
+		{
+			dst[n++] = *src;
+		}
+	}
+	dst[n] = '\0';
+}
+
+/********************************************************************
+ * Write an event with the current state
+ *  result > 0 = update still running, no result field
+ ********************************************************************/
+static void progress_event (struct progress *pg, long long now, int result)
+{
+	char line[512];
+	char device[256];
+	double elapsed = 0.0;
+	double rate = 0.0;
+	double eta = 0.0;
+	int len;
+
+	if (pg->start_ns)
+	{
+		elapsed = (now - pg->start_ns) / 1e9;
+	}
+	if (elapsed > 0.0)
+	{
+		rate = pg->bytes / elapsed;
+	}
+	if (rate > 0.0)
+	{
+		eta = (pg->total - pg->bytes) / rate;
+	}
+
+	progress_escape (device, sizeof (device), pg->device);
+
+	len = snprintf (line, sizeof (line),
+		"{\"device\": \"%s\", \"phase\": \"%s\", \"chunk\": %lu, \"chunks\": %lu, "
+		"\"bytes\": %llu, \"total\": %llu, \"rate\": %.0f, \"elapsed_s\": %.3f, \"eta_s\": %.1f",
+		device, pg->phase, pg->chunk, pg->chunks,
+		(unsigned long long) pg->bytes, (unsigned long long) pg->total, rate, elapsed, eta);
+
+	if (result <= 0 && len < (int) sizeof (line))
+	{
+		len += snprintf (line + len, sizeof (line) - len, ", \"result\": %d", result);
+	}
+
+	if (len < (int) sizeof (line) - 2)
+	{
+		strcpy (line + len, "}\n");
+		progress_emit (pg, line, len + 2);
+	}
+}
+
+/********************************************************************
+ * Show the progress line
+ ********************************************************************/
+static void progress_show (struct progress *pg, long long now)
+{
+	char line[80];
+	double elapsed = (now - pg->start_ns) / 1e9;
+	double rate = elapsed > 0.0 ? pg->bytes / elapsed : 0.0;
+	long eta = rate > 0.0 ? (long) ((pg->total - pg->bytes) / rate + 0.5) : 0;
+	int percent = pg->total ? pg->bytes * 100 / pg->total : 0;
+	int len;
+
+	len = snprintf (line, sizeof (line), "Written: %3d%%  %7.1f kB/s  ETA %2ld:%02ld \r",
+		percent, rate / 1000.0, eta / 60, eta % 60);
+
+	write (STDOUT_FILENO, line, len);
+}
+
+
+/********************************************************************
+ * Set up progress reporting
+ *  device = name in the events
+ *  fd = NDJSON event stream, -1 = none
+ *  hz = maximum updates per second
+ ********************************************************************/
+void progress_init (struct progress *pg, const char *device, int fd, int hz)
+{
+	memset (pg, 0, sizeof (*pg));
+
+	pg->device = device;
+	pg->fd = fd;
+	pg->tty = isatty (STDOUT_FILENO);
+	pg->interval_ns = 1000000000LL / (hz > 0 ? hz : PROGRESS_HZ);
+	pg->phase = "init";
+}
+
+/********************************************************************
+ * Enter a new phase, always reported
+ ********************************************************************/
+void progress_phase (struct progress *pg, const char *phase)
+{
+	if (!pg)
+	{
+		return;
+	}
+
+	pg->phase = phase;
+
+	if (pg->fd >= 0)
+	{
+		progress_event (pg, timing_now_ns (), 1);
+	}
+}
+
+/********************************************************************
+ * Begin of the transfer
+ ********************************************************************/
+void progress_start (struct progress *pg, unsigned long chunks, uint64_t total)
+{
+	if (!pg)
+	{
+		return;
+	}
+
+	pg->chunks = chunks;
+	pg->total = total;
+	pg->start_ns = timing_now_ns ();
+	pg->last_ns = pg->start_ns;
+
+	progress_phase (pg, "transfer");
+}
+
+/********************************************************************
+ * A chunk has been acknowledged
+ *  the display and the stream are updated at most hz times per
+ *  second and once for the last chunk
+ ********************************************************************/
+void progress_chunk (struct progress *pg, unsigned long chunk, uint64_t bytes)
+{
+	long long now;
+
+	if (!pg)
+	{
+		return;
+	}
+
+	pg->chunk = chunk;
+	pg->bytes = bytes;
+
+	now = timing_now_ns ();
+	if (now - pg->last_ns < pg->interval_ns && chunk < pg->chunks)
+	{
+		return;
+	}
+	pg->last_ns = now;
+
+	if (pg->tty)
+	{
+		progress_show (pg, now);
+	}
+	if (pg->fd >= 0)
+	{
+		progress_event (pg, now, 1);
+	}
+}
+
+/********************************************************************
+ * End of the update
+ *  result = return value of update()
+ ********************************************************************/
+void progress_end (struct progress *pg, int result)
+{
+	if (!pg)
+	{
+		return;
+	}
+
+	pg->phase = result ? "failed" : "done";
+
+	if (pg->fd >= 0)
+	{
+		progress_event (pg, timing_now_ns (), result);
+	}
+}
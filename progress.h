@@ -0,0 +1,70 @@
+/********************************************************************
+ *
+ * progress.h -- rate limited progress display and event stream
+ *
+ * Copyright (C) 2021 SCS GmbH & Co. KG, Hanau, Germany
+ * written by Peter Mack (peter.mack@scs-ptc.com)
+ *
+ * MIT License
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ *
+ ********************************************************************/
+
+#pragma once
+
+/********************************************************************
+ * Include files
+ ********************************************************************/
+#include <stdint.h>
+
+
+/********************************************************************
+ * Defines
+ ********************************************************************/
+#define PROGRESS_HZ		4		// default updates per second
+#define PROGRESS_STALL_MS	1000	// max. wait to finish a started event line
+
+
+/********************************************************************
+ * Types
+ ********************************************************************/
+struct progress {
+	const char *device;			// shown in the events
+	int fd;						// NDJSON event stream, -1 = none
+	int tty;					// progress line on stdout
+	long long interval_ns;		// minimum time between two updates
+	long long start_ns;			// begin of the transfer
+	long long last_ns;			// last update
+	const char *phase;
+	unsigned long chunk;
+	unsigned long chunks;
+	uint64_t bytes;
+	uint64_t total;
+};
+
+
+/********************************************************************
+ * Function prototypes
+ ********************************************************************/
+void progress_init (struct progress *pg, const char *device, int fd, int hz);
+void progress_phase (struct progress *pg, const char *phase);
+void progress_start (struct progress *pg, unsigned long chunks, uint64_t total);
+void progress_chunk (struct progress *pg, unsigned long chunk, uint64_t bytes);
+void progress_end (struct progress *pg, int result);
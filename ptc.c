@@ -41,8 +41,11 @@
 #include <string.h>
 #include <syslog.h>
 #include <time.h>
+#include <pthread.h>
+#include <inttypes.h>
 
 #include "serial.h"
+#include "match.h"
 #include "ptc.h"
 
 
@@ -50,40 +53,117 @@
  * Global variables
  ********************************************************************/
 static struct modemtype modems[] = {
-	//Type	Name           Ext.  HM-Log
-	{'A',	"PTC-II",     "pt2", false},
-	{'B',	"PTC-IIpro",  "pro", false},
-	{'C',	"PTC-IIe",    "pte", false},
-	{'D',	"PTC-IIex",   "pex", false},
-	{'E',	"PTC-IIusb",  "ptu", false},
-	{'F',	"PTC-IInet",  "ptn", false},
-	{'H',	"DR-7800",    "dr7", true},
-	{'I',	"DR-7400",    "dr7", true},
-	{'K',	"DR-7000",    "dr7", true},
-	{'L',	"PTC-IIIusb", "p3u", false},
-	{'T',	"PTC-IItrx",  "ptx", false},
+	//Type	Name           Ext.  HM-Log Window
+	{'A',	"PTC-II",     "pt2", false, 128},
+	{'B',	"PTC-IIpro",  "pro", false, 128},
+	{'C',	"PTC-IIe",    "pte", false, 128},
+	{'D',	"PTC-IIex",   "pex", false, 128},
+	{'E',	"PTC-IIusb",  "ptu", false, 128},
+	{'F',	"PTC-IInet",  "ptn", false, 128},
+	{'H',	"DR-7800",    "dr7", true,  512},
+	{'I',	"DR-7400",    "dr7", true,  512},
+	{'K',	"DR-7000",    "dr7", true,  512},
+	{'L',	"PTC-IIIusb", "p3u", false, 256},
+	{'T',	"PTC-IItrx",  "ptx", false, 128},
 };
 
+// everything ptc_reply() tells apart, line patterns start with MATCH_LINE
+static const struct {
+	const char *text;
+	enum ptc_reply reply;
+} ptc_patterns[] = {
+	{CMDSTR,			PTC_PROMPT},
+	{"Unknown command",	PTC_REJECTED},
+	{"Invalid command",	PTC_REJECTED},
+	{"Wrong parameter",	PTC_REJECTED},
+	{"ERROR:",			PTC_REJECTED},
+	{"\n#",				PTC_VERSION},
+	{"\nSer",			PTC_SERNUM},
+	{"\n***",			PTC_INFO},
+	{"\n",				PTC_LINE},
+};
+
+static struct match_set ptc_match;
+static pthread_once_t ptc_match_once = PTHREAD_ONCE_INIT;
+
 //struct modemtype modem = {
 //	0, NULL, NULL, false
 //};
 
 
+/********************************************************************
+ * Build the reply matcher, once
+ ********************************************************************/
+static void ptc_match_init (void)
+{
+	const char *text[sizeof (ptc_patterns) / sizeof (ptc_patterns[0])];
+	int i;
+
+	for (i = 0; i < sizeof (ptc_patterns) / sizeof (ptc_patterns[0]); i++)
+	{
+		text[i] = ptc_patterns[i].text;
+	}
+
+	match_init (&ptc_match, text, i);
+}
+
+
+/********************************************************************
+ * Wait for the next reply that matters
+ *  returns on the first decisive char, a line reply with the line
+ *  in line (without CR LF)
+ *  after an error reply the input up to the prompt is discarded,
+ *  so the next command starts clean
+ *
+ * Return enum ptc_reply
+ ********************************************************************/
+static int ptc_reply (struct ser_port *ser, char *line, size_t size)
+{
+	int r;
+
+	pthread_once (&ptc_match_once, ptc_match_init);
+
+	r = ser_expect (ser, &ptc_match, line, size);
+	if (r < 0)
+	{
+		return PTC_TIMEOUT;
+	}
+
+	if (PTC_REJECTED == ptc_patterns[r].reply)
+	{
+		syslog (LOG_MAKEPRI (LOG_USER, LOG_ERR), "ERROR: modem replied >%s<", ptc_patterns[r].text);
+		// exactly up to the prompt, replies to later commands stay
+		if (ser_wait (ser, CMDSTR))
+		{
+			return PTC_TIMEOUT;
+		}
+	}
+
+	return ptc_patterns[r].reply;
+}
+
+
 /********************************************************************
  * Send a command to the PTC (short for PACTOR Controller)
- * and wait for the given string
+ * and wait for the prompt
  *
  * Return 0 = Ok
- *       -1 = Error
+ *       -1 = Error or timeout
+ *       -2 = the modem rejected the command
  ********************************************************************/
-int PTC_cmd (int ser, char *cmd, size_t len)
+int PTC_cmd (struct ser_port *ser, char *cmd, size_t len)
 {
 	int res;
 
-	write (ser, cmd, len);
-	res = ser_wait (ser, CMDSTR);
+	res = ser_write_all (ser, cmd, len, SER_TIMEOUT_MS);
+	if (!res)
+	{
+		while ((res = ptc_reply (ser, NULL, 0)) > 0)
+		{
+		}
+	}
 
-	if (res)
+	if (PTC_TIMEOUT == res)
 	{
 		syslog (LOG_MAKEPRI (LOG_USER, LOG_ERR), "ERROR: timeout waiting for >%s<", cmd);
 	}
@@ -93,39 +173,199 @@ int PTC_cmd (int ser, char *cmd, size_t len)
 
 
 /********************************************************************
- * Feed the modem with commands from a file
+ * Wake the modem up with a CR and wait for the prompt
+ *  a PTC-II in autobaud mode finds the speed with this CR, so the
+ *  answer may take up to PTC_WAKE_MS
+ *
+ * Return 0 = Ok
+ *       -1 = Error or no answer
+ ********************************************************************/
+int PTC_wake (struct ser_port *ser)
+{
+	if (ser_write_all (ser, "\r", 1, SER_TIMEOUT_MS) || ser_wait_ms (ser, CMDSTR, PTC_WAKE_MS))
+	{
+		return -1;
+	}
+
+	return 0;
+}
+
+
+/********************************************************************
+ * Read a command file
+ *  every non empty line ends with CR, all lines in one buffer
+ *
+ *  Return number of commands, -1 = Error
+ *         start[i] is the offset of command i, start[n] the end
  ********************************************************************/
-void PTC_file (int ser, char *filename)
+static int ptc_read_file (char *filename, char **buf, size_t **start)
 {
 	FILE *f;
 	char *line = NULL;
-	size_t len = 0;
-
-	// TODO: was mache ich hier mit den Kommandos die beim Start des HM automatisch gesetzt werden?
+	size_t size = 0;
+	size_t used = 0;
+	size_t *s = NULL;
+	char *b = NULL;
+	ssize_t n;
+	int count = 0;
+	void *p;
 
 	f = fopen (filename, "r");
-
 	if (f == NULL)
 	{
 		syslog (LOG_MAKEPRI (LOG_USER, LOG_INFO), "INFO: could not open file >%s<", filename);
-		return;
+		return -1;
 	}
 
-	while (getline (&line, &len, f) != -1)
+	while ((n = getline (&line, &size, f)) != -1)
 	{
-		line[len - 1] = '\r';			// /n -> /r
+		while (n > 0 && (line[n - 1] == '\n' || line[n - 1] == '\r'))
+		{
+			n--;
+		}
+		if (0 == n)
+		{
+			continue;
+		}
+
+		p = realloc (b, used + n + 1);
+		if (NULL == p)
+		{
+			count = -1;
+			break;
+		}
+		b = p;
+		p = realloc (s, (count + 2) * sizeof (size_t));
+		if (NULL == p)
+		{
+			count = -1;
+			break;
+		}
+		s = p;
 
-		PTC_cmd (ser, line, len);
+		s[count++] = used;
+		memcpy (b + used, line, n);
+		used += n;
+		b[used++] = '\r';			// /n -> /r
 	}
 
+	free (line);
 	fclose (f);
+
+	if (count > 0)
+	{
+		s[count] = used;
+	}
+	if (count <= 0)
+	{
+		free (b);
+		free (s);
+		b = NULL;
+		s = NULL;
+	}
+	*buf = b;
+	*start = s;
+
+	return count;
+}
+
+
+/********************************************************************
+ * Feed the modem with commands from a file
+ *  pipelined, commands are sent ahead as long as the unanswered ones
+ *  fit into the input buffer of the modem (modem.window), every
+ *  prompt ends the oldest command in flight
+ *  the response and status of every command go to stdout and syslog
+ *
+ * Return number of failed commands
+ *        -1 = Error
+ ********************************************************************/
+int PTC_file (struct ser_port *ser, struct modemtype modem, char *filename)
+{
+	static const char *status[] = { "Ok", "rejected", "timeout" };
+	char line[256];
+	char response[1024];
+	size_t rlen = 0;
+	char *buf;
+	size_t *start;
+	size_t window;
+	int count, sent, done, from;
+	int failed = 0;
+	int st;
+	int r;
+
+	// TODO: was mache ich hier mit den Kommandos die beim Start des HM automatisch gesetzt werden?
+
+	count = ptc_read_file (filename, &buf, &start);
+	if (count <= 0)
+	{
+		return count;
+	}
+
+	window = modem.window ? modem.window : PTC_WINDOW_MIN;
+	sent = 0;
+	done = 0;
+
+	while (done < count)
+	{
+		// send what fits, at least the oldest command
+		from = sent;
+		while (sent < count && (sent == done || start[sent + 1] - start[done] <= window))
+		{
+			sent++;
+		}
+		if (sent > from && ser_write_all (ser, buf + start[from], start[sent] - start[from], SER_TIMEOUT_MS))
+		{
+			r = PTC_TIMEOUT;
+		}
+		else
+		{
+			r = ptc_reply (ser, line, sizeof (line));
+		}
+
+		if (r > 0)
+		{
+			// a response line of the oldest command
+			if (line[0] && rlen < sizeof (response))
+			{
+				rlen += snprintf (response + rlen, sizeof (response) - rlen, "  %s\n", line);
+			}
+			continue;
+		}
+
+		st = (PTC_PROMPT == r) ? 0 : (PTC_REJECTED == r) ? 1 : 2;
+		printf ("%.*s: %s\n%.*s", (int) (start[done + 1] - start[done] - 1), buf + start[done], status[st],
+				(int) rlen, response);
+		rlen = 0;
+		syslog (LOG_MAKEPRI (LOG_USER, st ? LOG_ERR : LOG_INFO), "%.*s: %s",
+				(int) (start[done + 1] - start[done] - 1), buf + start[done], status[st]);
+
+		if (st)
+		{
+			failed++;
+		}
+		done++;
+
+		if (PTC_TIMEOUT == r)
+		{
+			// replies can no longer be told apart
+			failed += count - done;
+			ser_flush (ser);
+			break;
+		}
+	}
+
+	free (buf);
+	free (start);
+
+	return failed;
 }
 
 
 /********************************************************************
  * Set date and time of modem
  ********************************************************************/
-void PTC_setTime (int ser, bool UTC)
+void PTC_setTime (struct ser_port *ser, bool UTC)
 {
 	#define TBUFMAX 40
 	time_t ct;
@@ -165,33 +405,30 @@ void PTC_setTime (int ser, bool UTC)
 /********************************************************************
  * Get the version string of the modem
  ********************************************************************/
-struct modemtype PTC_getVersion (int ser)
+struct modemtype PTC_getVersion (struct ser_port *ser)
 {
 	#define BUFMAX 256
 	char buf[BUFMAX];
-	int len;
-	int i;
+	int r;
 	char modemType = 0;
+	const struct modemtype *m;
 	struct modemtype modem = {
 		0, NULL, NULL, false
 	};
 
-	write (ser, "ver ##\r", 7);
-	while ((len = ser_getwait (ser, CMDSTR, buf)))
+	ser_write_all (ser, "ver ##\r", 7, SER_TIMEOUT_MS);
+	while ((r = ptc_reply (ser, buf, sizeof (buf))) > 0)
 	{
-		if (len > 2 && buf[0] == '#' && buf[1] == '0' && buf[2] == ':')
+		if (PTC_VERSION == r && !strncmp (buf, "#0:", 3))
 		{
 			modemType = buf[3];
 		}
 	}
 
-	for (i = 0; i < (sizeof(modems) / sizeof(struct modemtype)); i++)
+	m = PTC_getModemByVer (modemType);
+	if (m)
 	{
-		if (modemType == modems[i].ver)
-		{
-			modem = modems[i];
-			break;
-		}
+		modem = *m;
 	}
 
 	if (modem.ver)
@@ -207,26 +444,68 @@ struct modemtype PTC_getVersion (int ser)
 }
 
 
+/********************************************************************
+ * Find the modem type for a firmware file extension
+ * Return
+ *   first modem using this extension
+ *   NULL = unknown extension
+ ********************************************************************/
+const struct modemtype *PTC_getModemByExt (const char *ext)
+{
+	int i;
+
+	for (i = 0; i < (sizeof(modems) / sizeof(struct modemtype)); i++)
+	{
+		if (!strcasecmp (ext, modems[i].ext))
+		{
+			return &modems[i];
+		}
+	}
+
+	return NULL;
+}
+
+
+/********************************************************************
+ * Find the modem type for the type letter of ver ##
+ * Return
+ *   the modem
+ *   NULL = unknown type
+ ********************************************************************/
+const struct modemtype *PTC_getModemByVer (char ver)
+{
+	int i;
+
+	for (i = 0; i < (sizeof(modems) / sizeof(struct modemtype)); i++)
+	{
+		if (ver && ver == modems[i].ver)
+		{
+			return &modems[i];
+		}
+	}
+
+	return NULL;
+}
+
+
 /********************************************************************
  * Get the Hostmode PACTOR channel
  * Return
  *   1... 31 - PACTOR channel
  *   negative = Error
  ********************************************************************/
-int PTC_getPTChn (int ser)
+int PTC_getPTChn (struct ser_port *ser)
 {
-	int len;
+	int r;
 	char buf[40];
 	int ptc = -1;
 	char *p;
 
-	write (ser, "ptc\r", 4);
-	while ((len = ser_getwait (ser, CMDSTR, buf)))
+	ser_write_all (ser, "ptc\r", 4, SER_TIMEOUT_MS);
+	while ((r = ptc_reply (ser, buf, sizeof (buf))) > 0)
 	{
-		if (len > 2 && buf[0] == '*' && buf[1] == '*' && buf[2] == '*')
+		if (PTC_INFO == r && (p = strrchr (buf, ' ')))
 		{
-			buf[len - 2] = 0;
-			p = strrchr (buf, ' ');
 			ptc = atoi (++p);
 		}
 	}
@@ -241,20 +520,18 @@ int PTC_getPTChn (int ser)
  *   true  - Serial number ok
  *   false - Error = serial number not valid
  ********************************************************************/
-bool PTC_getSerNum (int ser, uint64_t *sernum)
+bool PTC_getSerNum (struct ser_port *ser, uint64_t *sernum)
 {
-	int len;
+	int r;
 	char buf[40];
 	char *p;
 	bool ret = false;
 
-	write (ser, "sys sern\r", 9);
-	while ((len = ser_getwait (ser, CMDSTR, buf)))
+	ser_write_all (ser, "sys sern\r", 9, SER_TIMEOUT_MS);
+	while ((r = ptc_reply (ser, buf, sizeof (buf))) > 0)
 	{
-		if (len > 2 && buf[0] == 'S' && buf[1] == 'e' && buf[2] == 'r')
+		if (PTC_SERNUM == r && (p = strrchr (buf, ' ')))
 		{
-			buf[len - 2] = 0;
-			p = strrchr (buf, ' ');
 			*sernum = strtoull (++p, NULL, 16);
 			ret = true;
 		}
@@ -262,3 +539,86 @@ bool PTC_getSerNum (int ser, uint64_t *sernum)
 
 	return ret;
 }
+
+
+/********************************************************************
+ * Identify the modem in one exchange
+ *  ver ##, sys sern and ptc go out back to back, the replies are
+ *  told apart by counting the prompts
+ * Return:
+ *   0 = Ok, id filled in
+ *  -1 = Error, no answer or unknown modem type
+ ********************************************************************/
+int PTC_identify (struct ser_port *ser, struct ptc_identity *id)
+{
+	static const char probe[] = "ver ##\rsys sern\rptc\r";
+	const struct modemtype *m;
+	char buf[BUFMAX];
+	char modemType = 0;
+	int prompts = 0;
+	char *p;
+	int r;
+
+	memset (id, 0, sizeof (*id));
+	id->ptc = -1;
+
+	if (ser_write_all (ser, probe, sizeof (probe) - 1, SER_TIMEOUT_MS))
+	{
+		return -1;
+	}
+
+	while (prompts < 3)
+	{
+		r = ptc_reply (ser, buf, sizeof (buf));
+		switch (r)
+		{
+			case PTC_TIMEOUT:
+				syslog (LOG_MAKEPRI (LOG_USER, LOG_ERR), "ERROR: no answer to the identity probe");
+				return -1;
+
+			case PTC_PROMPT:
+			case PTC_REJECTED:
+				prompts++;
+				break;
+
+			case PTC_VERSION:
+				if (0 == prompts && id->versions < PTC_VERSIONS)
+				{
+					snprintf (id->version[id->versions++], PTC_VERSION_LEN, "%.*s", PTC_VERSION_LEN - 1, buf);
+					if (!strncmp (buf, "#0:", 3))
+					{
+						modemType = buf[3];
+					}
+				}
+				break;
+
+			case PTC_SERNUM:
+				if (1 == prompts && (p = strrchr (buf, ' ')))
+				{
+					id->sernum = strtoull (++p, NULL, 16);
+					id->has_sernum = true;
+				}
+				break;
+
+			case PTC_INFO:
+				if (2 == prompts && (p = strrchr (buf, ' ')))
+				{
+					id->ptc = atoi (++p);
+				}
+				break;
+		}
+	}
+
+	m = PTC_getModemByVer (modemType);
+	if (NULL == m)
+	{
+		syslog (LOG_MAKEPRI (LOG_USER, LOG_ERR), "ERROR: unknown modem type: %c", modemType);
+		return -1;
+	}
+	id->modem = *m;
+
+	syslog (LOG_MAKEPRI (LOG_USER, LOG_INFO), "Modem detected: %s, serial number %016" PRIX64 ", PACTOR channel %d",
+			id->modem.name, id->sernum, id->ptc);
+
+	return 0;
+}
@@ -36,30 +36,60 @@
 #include <stdint.h>
 #include <stdbool.h>
 
+#include "serial.h"
+
 
 /********************************************************************
  * Defines
  ********************************************************************/
 #define CMDSTR	"cmd: "
+#define PTC_WINDOW_MIN	64		// command bytes in flight for an unknown modem type
+#define PTC_WAKE_MS		3000	// first answer, a PTC-II may still be autobauding
+#define PTC_VERSIONS	8		// ver ## lines kept by PTC_identify()
+#define PTC_VERSION_LEN	48
 
 
 /********************************************************************
  * Types
  ********************************************************************/
+enum ptc_reply {
+	PTC_REJECTED = -2,	// error reply, the rest up to the prompt is discarded
+	PTC_TIMEOUT = -1,
+	PTC_PROMPT = 0,		// CMDSTR, the command is done
+	PTC_VERSION,		// "#n:" line of ver ##
+	PTC_SERNUM,			// "Ser" line of sys sern
+	PTC_INFO,			// "***" line
+	PTC_LINE			// any other line
+};
+
 struct modemtype {
 	char ver;
 	char *name;
 	char *ext;
 	bool log;
+	int window;		// command input buffer, bytes in flight for PTC_file()
+};
+
+struct ptc_identity {
+	struct modemtype modem;		// from the #0: line, ver = 0 if unknown
+	char version[PTC_VERSIONS][PTC_VERSION_LEN];	// ver ## lines, e.g. "#0:H"
+	int versions;
+	uint64_t sernum;
+	bool has_sernum;
+	int ptc;					// PACTOR channel, -1 = unknown
 };
 
 
 /********************************************************************
  * Function prototypes
  ********************************************************************/
-int PTC_cmd (int ser, char *cmd, size_t len);
-void PTC_file (int ser, char *filename);
-void PTC_setTime (int ser, bool UTC);
-struct modemtype PTC_getVersion (int ser);
-int PTC_getPTChn (int ser);
-bool PTC_getSerNum (int ser, uint64_t *sernum);
+int PTC_cmd (struct ser_port *ser, char *cmd, size_t len);
+int PTC_wake (struct ser_port *ser);
+int PTC_file (struct ser_port *ser, struct modemtype modem, char *filename);
+void PTC_setTime (struct ser_port *ser, bool UTC);
+struct modemtype PTC_getVersion (struct ser_port *ser);
+const struct modemtype *PTC_getModemByExt (const char *ext);
+const struct modemtype *PTC_getModemByVer (char ver);
+int PTC_identify (struct ser_port *ser, struct ptc_identity *id);
+int PTC_getPTChn (struct ser_port *ser);
+bool PTC_getSerNum (struct ser_port *ser, uint64_t *sernum);
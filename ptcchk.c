@@ -33,64 +33,43 @@
 #include <stdio.h>
 #include <stdint.h>
 #include <stdlib.h>
-#include <unistd.h>
-#include <limits.h>
 
 #include "crc.h"
+#include "fwimage.h"
 #include "ptcchk.h"
 
 
-/********************************************************************
- * Defines
- ********************************************************************/
-#define HEADER_PT	0xEA60
-
-
-/********************************************************************
- * Global variables
- ********************************************************************/
-extern uint32_t crctable[UCHAR_MAX + 1];
-extern uint32_t crc;
-
-
 /********************************************************************
  * Quick header check
+ *  threads is passed to crc32_parallel(), 0 = one per CPU
  * Return:
  *  0 = Ok
  *  negative = Error
  ********************************************************************/
-int ptccheck (int f)
+int ptccheck (const struct fw_image *img, int threads)
 {
-	long unsigned int size;
-
-	make_crctable ();
-
-	if (HEADER_PT != get_word (f))
+	if (HEADER_PT != img->header)
 	{
-		close (f);
 		fprintf (stderr, "ERROR: Wrong header ID.\n");
 		return -1;
 	}
 
-	size = get_word (f);
-
-	// calculate CRC
-	crc = CRC_MASK;
-	while (size--)
+	// header, data, CRC and a terminating zero word
+	if (img->length > img->size - 10)
 	{
-		UPDATE_CRC(crc, get_byte (f));
+		fprintf (stderr, "ERROR: file too short.\n");
+		return -2;
 	}
 
-	if ((crc ^ CRC_MASK) != get_long (f))
+	// calculate CRC, split over several threads for large images
+	if (crc32_parallel (img->data + 4, img->length, threads) != fw_get_long (img, 4 + img->length))
 	{
-		close (f);
 		fprintf (stderr, "ERROR: wrong CRC.\n");
 		return -2;
 	}
 
-	if (get_word (f))
+	if (fw_get_word (img, 8 + img->length))
 	{
-		close (f);
 		fprintf (stderr, "ERROR: wrong data.\n");
 		return -3;
 	}
@@ -29,7 +29,13 @@
 
 #pragma once
 
+/********************************************************************
+ * Include files
+ ********************************************************************/
+#include "fwimage.h"
+
+
 /********************************************************************
  * Function prototypes
  ********************************************************************/
-int ptccheck (int f);
+int ptccheck (const struct fw_image *img, int threads);
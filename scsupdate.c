@@ -48,262 +48,360 @@
 #include <sys/types.h>
 #include <sys/ioctl.h>
 #include <linux/serial.h>
-#include <libusb-1.0/libusb.h>
-#include <dirent.h>
 #include <syslog.h>
+#include <getopt.h>
 
 #include "serial.h"
 #include "ptc.h"
 #include "update.h"
-
-
-/*
- USB Product IDs of the SCS devices:
-    0xD010 SCS PTC-IIusb
-    0xD011 SCS Tracker / DSP TNC
-    0xD012 SCS P4dragon DR-7800
-    0xD013 SCS P4dragon DR-7400
-    0xD014 - not used
-    0xD015 SCS PTC-IIIusb
-    0xD016 - not used
-    0xD017 - not used
-*/
+#include "catalog.h"
+#include "link.h"
+#include "timing.h"
+#include "fleet.h"
+#include "devcache.h"
+#include "usbdev.h"
+#include "hotplug.h"
 
 
 /********************************************************************
  * Defines
  ********************************************************************/
-#define SYSFS_PATH "/sys/bus/usb/devices/%u-"
-#define MAX_SCS_DEVICES 8		// max. number of SCS devices we search for
 #ifndef VERSION
 #define VERSION "x.x"
 #endif
 
 
-/********************************************************************
- * Structs
- ********************************************************************/
-struct Modem {
-	const char *type;
-	const speed_t baud;
-};
-
-struct SCS_Devices {
-	char tty[270];	// the tty device, e.g. /dev/ttyUSB1
-	uint8_t type;	// index to the modems array
-};
-
-
 /********************************************************************
  * Global Variables
  ********************************************************************/
-const struct Modem modems[] = {
-	{"PTC-IIusb",			115200},	// 0
-	{"Tracker / DSP TNC",	 38400},	// 1
-	{"P4dragon DR-7800",	829440},	// 2
-	{"P4dragon DR-7400",	829440},	// 3
-	{"", 0},							// 4
-	{"PTC-IIIusb",			115200},	// 5
-	{"", 0},							// 6
-	{"", 0}								// 7
-};
-
 int run;
 
 
 /********************************************************************
- * Helper function for scandir
- * to find the USB serial device name
+ * Signal handler
  ********************************************************************/
-static int srchtty (const struct dirent *ep)
+void sigHandler (int sig)
 {
-	if (strstr (ep->d_name, "ttyUSB"))
+	if (sig == SIGINT || sig == SIGTERM || sig == SIGQUIT || sig == SIGKILL || sig == SIGHUP)
 	{
-		return 1;
+		run = 0;
 	}
-
-	return 0;
 }
 
+/********************************************************************
+ * Usage
+ ********************************************************************/
+void usage (void)
+{
+	fprintf (stderr, "\nUsage:\n");
+	fprintf (stderr, "  scsupdate [options] <file>\n");
+	fprintf (stderr, "    tries to auto detect any SCS modem with USB port\n\n");
+	fprintf (stderr, "    or provide port and baudrate manually\n\n");
+	fprintf (stderr, "  scsupdate [options] <device> <speed> <file>\n");
+	fprintf (stderr, "    e.g. scsupdate /dev/ttyS1 115200 profi41r.pro\n");
+	fprintf (stderr, "    <device> can be a serial port on a terminal server:\n");
+	fprintf (stderr, "    tcp://<host>:<port> (raw) or rfc2217://<host>:<port>\n\n");
+	fprintf (stderr, "  scsupdate --all [--filter=<list>] <file|dir>...\n");
+	fprintf (stderr, "    update all SCS modems with USB port at once, each one with\n");
+	fprintf (stderr, "    the file of its type from the given files and directories,\n");
+	fprintf (stderr, "    --filter limits the update to the given model names or\n");
+	fprintf (stderr, "    serial numbers (comma separated)\n\n");
+	fprintf (stderr, "  scsupdate --watch [--filter=<list>] <file|dir>...\n");
+	fprintf (stderr, "    wait for SCS modems with USB port and update every modem\n");
+	fprintf (stderr, "    when it is plugged in, until Ctrl-C\n\n");
+	fprintf (stderr, "  scsupdate --identify [<device> <speed>]\n");
+	fprintf (stderr, "    print type, version, serial number and PACTOR channel\n");
+	fprintf (stderr, "    of the modem and update nothing\n\n");
+	fprintf (stderr, "  scsupdate --catalog <dir>\n");
+	fprintf (stderr, "    check all firmware files in <dir> and record the results,\n");
+	fprintf (stderr, "    later updates skip the CRC check of unchanged files\n\n");
+	fprintf (stderr, "Options:\n");
+	fprintf (stderr, "  --autobaud[=<max>]\n");
+	fprintf (stderr, "    measure the link and switch modem and port to the highest\n");
+	fprintf (stderr, "    reliable speed up to <max> (default %d) before updating\n\n", LINK_MAX_BAUD);
+	fprintf (stderr, "  --no-low-latency\n");
+	fprintf (stderr, "    keep the FTDI latency timer and the ASYNC_LOW_LATENCY flag\n");
+	fprintf (stderr, "    of the port as they are during the update\n\n");
+	fprintf (stderr, "  --idle-gap=<ms>\n");
+	fprintf (stderr, "    silence after the UPDATE message before the transfer starts\n");
+	fprintf (stderr, "    (default %d ms)\n\n", UPDATE_IDLE_MS);
+	fprintf (stderr, "  --reply-timeout=<ms>\n");
+	fprintf (stderr, "    max. silence within a command reply of the modem\n");
+	fprintf (stderr, "    (default %d ms)\n\n", SER_TIMEOUT_MS);
+	fprintf (stderr, "  --timing=<file>\n");
+	fprintf (stderr, "    write the time of every phase, the ACK latency percentiles\n");
+	fprintf (stderr, "    and a Chrome trace event timeline as JSON to <file>\n\n");
+	fprintf (stderr, "  --progress-fd=<n>\n");
+	fprintf (stderr, "    write progress events as newline delimited JSON to fd <n>\n\n");
+	fprintf (stderr, "  --progress-rate=<hz>\n");
+	fprintf (stderr, "    update the progress at most <hz> times per second (default %d)\n\n", PROGRESS_HZ);
+	fprintf (stderr, "  --stats\n");
+	fprintf (stderr, "    print bytes, syscalls, short reads, timeouts and the read\n");
+	fprintf (stderr, "    latency of every port when it is closed\n\n");
+	fprintf (stderr, "  --no-cache\n");
+	fprintf (stderr, "    always ask the modem for type, version and serial number,\n");
+	fprintf (stderr, "    do not use or update the device cache\n\n");
+	exit (1);
+}
 
 /********************************************************************
- * Helper function to free dirent structure
+ * Print the identity of a modem
  ********************************************************************/
-void free_dirent (struct dirent ***ent, int n)
+static void print_identity (const char *tty, const struct ptc_identity *id, bool cached)
 {
-	struct dirent **ep;
+	int i;
 
-	ep = *ent;
-	for (int i = 0; i < n; i++)
+	printf ("Port:           %s%s\n", tty, cached ? " (cached)" : "");
+	printf ("Modem:          %s\n", id->modem.name);
+	if (id->has_sernum)
+	{
+		printf ("Serial number:  %016" PRIX64 "\n", id->sernum);
+	}
+	else
+	{
+		printf ("Serial number:  unknown\n");
+	}
+	printf ("PACTOR channel: %d\n", id->ptc);
+	for (i = 0; i < id->versions; i++)
 	{
-		free (ep[i]);
+		printf ("%-16s%s\n", i ? "" : "Version:", id->version[i]);
 	}
-	free (ep);
 }
 
-
 /********************************************************************
- * Search for SCS USB devices
+ * Main function
  ********************************************************************/
-static int find_devices (struct SCS_Devices devs[])
+int main (int argc, char *argv[])
 {
-	int err = 0;
-	libusb_context *ctx;
-	libusb_device **list;
-	struct libusb_device_descriptor desc;
-	int status;
-	ssize_t num_devs, i;
-	char path[PATH_MAX];
-	int n;
-	struct dirent **ent;
-
-#define PNUM_MAX 8
-	uint8_t pnums[PNUM_MAX];
-	int numports;
-
-#define MAX_BUF 10
-	char buf[MAX_BUF];
-
-	status = 0;	// 0 device not found, > 0 device found
-
-	err = libusb_init (&ctx);
-	if (err)
+	char serdev[256];
+	struct ser_port *ser;
+	speed_t baudrate;
+	int i, n, r;
+	int num = 0;
+	int ret = EXIT_FAILURE;
+	struct SCS_Devices devs[MAX_SCS_DEVICES];
+	struct ptc_identity id;
+	char key[DEVCACHE_KEY];
+	bool cached = false;
+	bool nocache = false;
+	bool identify = false;
+	char *fwfile;
+	char *catalog = NULL;
+	int autobaud = 0;
+	char *timingfile = NULL;
+	struct timing timing;
+	struct timing *tm = NULL;
+	struct progress pg;
+	int progressfd = -1;
+	int progresshz = PROGRESS_HZ;
+	bool all = false;
+	bool watch = false;
+	bool lowlatency = true;
+	struct fleet fleet = { .filter = NULL };
+	int opt;
+
+	static const struct option options[] = {
+		{"autobaud",	optional_argument,	NULL, 'a'},
+		{"catalog",	required_argument,	NULL, 'c'},
+		{"idle-gap",	required_argument,	NULL, 'i'},
+		{"reply-timeout",	required_argument,	NULL, 'T'},
+		{"timing",	required_argument,	NULL, 't'},
+		{"progress-fd",	required_argument,	NULL, 'p'},
+		{"progress-rate",	required_argument,	NULL, 'r'},
+		{"all",	no_argument,		NULL, 'A'},
+		{"watch",	no_argument,		NULL, 'w'},
+		{"filter",	required_argument,	NULL, 'f'},
+		{"no-low-latency",	no_argument,	NULL, 'L'},
+		{"stats",	no_argument,		NULL, 's'},
+		{"no-cache",	no_argument,		NULL, 'C'},
+		{"identify",	no_argument,		NULL, 'I'},
+		{"help",	no_argument,		NULL, 'h'},
+		{NULL, 0, NULL, 0}
+	};
+
+	printf ("SCS Update for Linux\n"
+		"Version " VERSION "\n"
+		"Copyright (C) 1998-2021 SCS GmbH & Co. KG, Hanau, Germany\n\n");
+
+	while ((opt = getopt_long (argc, argv, "h", options, NULL)) != -1)
 	{
-		fprintf (stderr, "ERROR: unable to initialize libusb: %i\n", err);
-		goto error;
+		switch (opt)
+		{
+			case 'a':
+				autobaud = optarg ? strtol (optarg, NULL, 10) : LINK_MAX_BAUD;
+				break;
+
+			case 'c':
+				catalog = optarg;
+				break;
+
+			case 'i':
+				update_idle_ms = strtol (optarg, NULL, 10);
+				break;
+
+			case 'T':
+				ser_timeout_ms = strtol (optarg, NULL, 10);
+				break;
+
+			case 't':
+				timingfile = optarg;
+				tm = &timing;
+				timing_init (tm);
+				break;
+
+			case 'p':
+				progressfd = strtol (optarg, NULL, 10);
+				if (fcntl (progressfd, F_GETFD) < 0)
+				{
+					fprintf (stderr, "ERROR: progress fd %s is not open\n", optarg);
+					usage ();
+				}
+				signal (SIGPIPE, SIG_IGN);	// a reader that goes away must not kill the update
+				break;
+
+			case 'r':
+				progresshz = strtol (optarg, NULL, 10);
+				break;
+
+			case 'A':
+				all = true;
+				break;
+
+			case 'w':
+				watch = true;
+				break;
+
+			case 'f':
+				fleet.filter = optarg;
+				break;
+
+			case 'L':
+				lowlatency = false;
+				break;
+
+			case 's':
+				ser_show_stats = true;
+				break;
+
+			case 'C':
+				nocache = true;
+				break;
+
+			case 'I':
+				identify = true;
+				break;
+
+			default:
+				usage ();
+		}
 	}
+	argc -= optind;
+	argv += optind;
+
+	openlog ("scsupdate", LOG_PID | LOG_NDELAY, LOG_USER);
 
-	num_devs = libusb_get_device_list (ctx, &list);
-	if (num_devs < 0)
+	if (catalog)
 	{
-		fprintf (stderr, "ERROR: getting device list: %li\n", num_devs);
-		goto error1;
+		r = catalog_build (catalog, 0);
+		closelog ();
+		return r ? EXIT_FAILURE : EXIT_SUCCESS;
 	}
 
-	for (i = 0; i < num_devs && status < MAX_SCS_DEVICES; ++i)
+	if (watch)
 	{
-		libusb_device *dev = list[i];
-
-		libusb_get_device_descriptor (dev, &desc);
-		if ((0x0403 != desc.idVendor) || (0xD010 != (desc.idProduct & 0xFFF8)))
-			continue;
+		if (argc < 1)
+		{
+			usage ();
+		}
 
-		status++;
+		fleet.files = argv;
+		fleet.nfiles = argc;
+		fleet.autobaud = autobaud;
+		fleet.lowlatency = lowlatency;
+		fleet.progressfd = progressfd;
+		fleet.progresshz = progresshz;
+		fleet.nocache = nocache;
 
-		uint8_t bnum = libusb_get_bus_number (dev);
-		numports = libusb_get_port_numbers (dev, pnums, PNUM_MAX);
+		// stop taking new modems, the running updates are finished
+		run = 1;
+		signal (SIGINT, sigHandler);
+		signal (SIGTERM, sigHandler);
+		signal (SIGHUP, sigHandler);
 
-#ifdef DEBUG
-		printf ("ID %04x:%04x - ", desc.idVendor, desc.idProduct);
-#endif /* DEBUG */
+		r = hotplug_run (&fleet, &run);
 
-		snprintf (path, sizeof(path), SYSFS_PATH, bnum);
+		closelog ();
+		return r ? EXIT_FAILURE : EXIT_SUCCESS;
+	}
 
-		for (n = 0; n < numports - 1; n++)
+	if (all)
+	{
+		if (argc < 1)
 		{
-			snprintf (buf, MAX_BUF, "%u.", pnums[n]);
-			strcat (path, buf);
+			usage ();
 		}
-		snprintf (buf, MAX_BUF, "%u:1.0/", pnums[n]);
-		strcat (path, buf);
-
-#ifdef DEBUG
-		printf ("%s -> ", path);
-#endif /* DEBUG */
 
-		n = scandir (path, &ent, srchtty, alphasort);
-		if (1 != n)
+		n = find_devices (devs);
+		if (!n)
 		{
-			fprintf (stderr, "USB search: tty search error (%d)", n);
+			printf ("No SCS devices found!\n");
+			closelog ();
+			return EXIT_FAILURE;
 		}
 
-		// tty name is in ent[0]->d_name
-#ifdef DEBUG
-		printf ("/dev/%s\n", ent[0]->d_name);
-#endif /* DEBUG */
+		fleet.devs = calloc (n, sizeof (struct fleet_device));
+		fleet.count = n;
+		fleet.files = argv;
+		fleet.nfiles = argc;
+		fleet.autobaud = autobaud;
+		fleet.lowlatency = lowlatency;
+		fleet.progressfd = progressfd;
+		fleet.progresshz = progresshz;
+		fleet.nocache = nocache;
 
-		sprintf (devs[status - 1].tty, "/dev/%s", ent[0]->d_name);
-		devs[status - 1].type = desc.idProduct & 0x7;
-
-		free_dirent (&ent, n);
-	}
-
-	libusb_free_device_list (list, 0);
-
-error1:
-	libusb_exit (ctx);
-
-error:
-	return status;
-}
+		for (i = 0; i < n; i++)
+		{
+			strcpy (fleet.devs[i].tty, devs[i].tty);
+			fleet.devs[i].usbtype = modems[devs[i].type].type;
+			fleet.devs[i].baud = modems[devs[i].type].baud;
+			fleet.devs[i].status = "not started";
+		}
 
+		printf ("Updating %d SCS modems\n", n);
+		r = fleet_update (&fleet);
 
-/********************************************************************
- * Signal handler
- ********************************************************************/
-void sigHandler (int sig)
-{
-	if (sig == SIGINT || sig == SIGTERM || sig == SIGQUIT || sig == SIGKILL || sig == SIGHUP)
-	{
-		run = 0;
+		free (fleet.devs);
+		closelog ();
+		return r ? EXIT_FAILURE : EXIT_SUCCESS;
 	}
-}
 
-/********************************************************************
- * Usage
- ********************************************************************/
-void usage (void)
-{
-	fprintf (stderr, "\nUsage:\n");
-	fprintf (stderr, "  scsupdate <file>\n");
-	fprintf (stderr, "    tries to auto detect any SCS modem with USB port\n\n");
-	fprintf (stderr, "    or provide port and baudrate manually\n\n");
-	fprintf (stderr, "  scsupdate <device> <speed> <file>\n");
-	fprintf (stderr, "    e.g. scsupdate /dev/ttyS1 115200 profi41r.pro\n\n");
-	exit (1);
-}
-
-/********************************************************************
- * Main function
- ********************************************************************/
-int main (int argc, char *argv[])
-{
-	char serdev[256];
-	int ser;
-	speed_t baudrate;
-	int i, n, r;
-	int num = 0;
-	struct SCS_Devices devs[MAX_SCS_DEVICES];
-	struct modemtype modem;
-	uint64_t ptsernum;
-	char *fwfile;
-
-	printf ("SCS Update for Linux\n"
-		"Version " VERSION "\n"
-		"Copyright (C) 1998-2021 SCS GmbH & Co. KG, Hanau, Germany\n\n");
-
-	if (argc != 2 && argc != 4)
+	// --identify takes no firmware file
+	if (argc != 1 - identify && argc != 3 - identify)
 	{
 		usage ();
 	}
 
-	openlog ("scsupdate", LOG_PID | LOG_NDELAY, LOG_USER);
+	fwfile = identify ? NULL : argv[0];
 
-	fwfile = argv[1];
-
-	if (argc == 4)
+	if (argc == 3 - identify)
 	{
-		if (!strncmp (argv[1], "/dev/", 5))
+		if (ser_is_port (argv[0]))
 		{
-			strcpy (serdev, argv[1]);
-			baudrate = strtol (argv[2], NULL, 10);
+			strcpy (serdev, argv[0]);
+			baudrate = strtol (argv[1], NULL, 10);
 			printf ("Using %s with %d baud\n", serdev, baudrate);
-			fwfile = argv[3];
+			fwfile = identify ? NULL : argv[2];
 			goto no_auto;
 		}
+		else if (identify)
+		{
+			usage ();
+		}
 	}
 
+	timing_begin (tm, PHASE_DISCOVERY);
 	n = find_devices (devs);	// find all SCS USB devices
+	timing_end (tm, PHASE_DISCOVERY);
 
 #ifdef DEBUG
 	printf ("Found %d SCS devices\n", n);
@@ -347,8 +445,23 @@ int main (int argc, char *argv[])
 	baudrate = modems[devs[num].type].baud;
 
 no_auto:
+	if (nocache || devcache_key (serdev, key, sizeof (key)))
+	{
+		key[0] = '\0';
+	}
+
+	// an identity with version lines answers --identify without the modem
+	if (identify && key[0] && 0 == devcache_lookup (key, &id) && id.versions)
+	{
+		print_identity (serdev, &id, true);
+		ret = EXIT_SUCCESS;
+		goto ERR_EXIT;
+	}
+
+	timing_begin (tm, PHASE_OPEN);
 	ser = ser_open (serdev, baudrate);
-	if (ser <= 0)
+	timing_end (tm, PHASE_OPEN);
+	if (NULL == ser)
 	{
 		syslog (LOG_MAKEPRI(LOG_USER, LOG_ERR), "ERROR: could not open modem port");
 		goto ERR_EXIT;
@@ -357,24 +470,80 @@ no_auto:
 
 	//----------
 
-	PTC_cmd (ser, "\r", 1);		// if a PTC-II is in autobaud mode send a CR and wait for the cmd: prompt
+	// if a PTC-II is in autobaud mode send a CR and wait for the cmd: prompt
+	if (PTC_wake (ser))
+	{
+		fprintf (stderr, "ERROR: modem on %s does not answer!\n", serdev);
+		syslog (LOG_MAKEPRI(LOG_USER, LOG_ERR), "ERROR: modem does not answer");
+		ser_close (ser);
+		goto ERR_EXIT;
+	}
+
+	if (!identify && lowlatency)
+	{
+		link_low_latency (ser);
+	}
 
-	modem = PTC_getVersion (ser);		// get modem version
+	// a modem seen on this USB port before needs no identity probe
+	timing_begin (tm, PHASE_IDENTIFY);
+	if (!identify && key[0] && 0 == devcache_lookup (key, &id))
+	{
+		cached = true;
+		syslog (LOG_MAKEPRI(LOG_USER, LOG_INFO), "Modem detected: %s (cached for %s)", id.modem.name, key);
+	}
+	else if (PTC_identify (ser, &id))
+	{
+		fprintf (stderr, "ERROR: could not identify the modem on %s\n", serdev);
+		timing_end (tm, PHASE_IDENTIFY);
+		ser_close (ser);
+		goto ERR_EXIT;
+	}
+	else if (key[0])
+	{
+		devcache_store (key, &id);
+	}
+	timing_end (tm, PHASE_IDENTIFY);
 
-	if (!PTC_getSerNum (ser, &ptsernum))
+	if (!id.has_sernum)
 	{
 		syslog (LOG_MAKEPRI(LOG_USER, LOG_ERR), "ERROR: could not serial number");
-		ptsernum = 0xffffffffffffffff;
 	}
 	else
 	{
-		syslog (LOG_MAKEPRI(LOG_USER, LOG_INFO), "Modem serial number: %016" PRIX64 "", ptsernum);
+		syslog (LOG_MAKEPRI(LOG_USER, LOG_INFO), "Modem serial number: %016" PRIX64 "", id.sernum);
+	}
+
+	if (identify)
+	{
+		print_identity (serdev, &id, false);
+		ret = EXIT_SUCCESS;
+		ser_close (ser);
+		goto ERR_EXIT;
 	}
 
 #if 1
-	r = update (ser, modem, fwfile);
+	progress_init (&pg, serdev, progressfd, progresshz);
+
+	r = update (ser, id.modem, fwfile, autobaud, tm, &pg);
+
+	progress_end (&pg, r);
+
+	// a new firmware changes only the version, a failure may mean the entry is stale
+	if (key[0] && 0 == r)
+	{
+		id.versions = 0;
+		devcache_store (key, &id);
+	}
+	else if (key[0] && cached && -1 == r)
+	{
+		devcache_store (key, NULL);
+	}
 
-	if (-1 == r)
+	if (0 == r)
+	{
+		ret = EXIT_SUCCESS;
+	}
+	else if (-1 == r)
 	{
 		fprintf (stderr, "Update failed!\n");
 		syslog (LOG_MAKEPRI(LOG_USER, LOG_ERR), "ERROR: Update failed");
@@ -384,13 +553,25 @@ no_auto:
 		fprintf (stderr, "Update canceled by user!\n");
 		syslog (LOG_MAKEPRI(LOG_USER, LOG_ERR), "ERROR: Update canceled by user");
 	}
+
+	// the next run opens the modem at its usual speed again
+	if (r)
+	{
+		link_restore (ser, baudrate);
+	}
 #endif
-	close (ser);
+	ser_close (ser);
 
 ERR_EXIT:
 	printf ("\n");
 
+	if (tm)
+	{
+		timing_write (tm, timingfile);
+		timing_free (tm);
+	}
+
 	closelog ();
 
-	return EXIT_SUCCESS;
+	return ret;
 }
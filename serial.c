@@ -31,6 +31,7 @@
  * Include files
  ********************************************************************/
 #include <stdbool.h>
+#include <stdint.h>
 #include <fcntl.h>
 #include <unistd.h>
 #include <asm-generic/termbits.h>
@@ -38,39 +39,142 @@
 #include <string.h>
 #include <errno.h>
 #include <syslog.h>
+#include <poll.h>
+#include <time.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <signal.h>
+#include <pthread.h>
+#include <sys/uio.h>
+#include <inttypes.h>
+#include <linux/serial.h>
 
 #ifdef __linux__
 #include "lock.h"	// handle UUCP style lock files
 #endif /* __linux__ */
 #include "serial.h"
+#include "sernet.h"
+#include "match.h"
 
 
 /********************************************************************
- * ser_open
- *  open a serial device and configure it
+ * Types
+ ********************************************************************/
+struct ser_latency {
+	int ser;				// -1 = free slot
+	char path[SER_NAME_MAX + 64];	// sysfs latency_timer of the port, "" = none
+	int timer;				// original latency timer, -1 = unchanged
+	int flags;				// original serial_struct flags, -1 = unchanged
+};
+
+
+/********************************************************************
+ * Global variables
+ ********************************************************************/
+static struct ser_latency ser_tuned[SER_MAX_TUNED];
+static pthread_mutex_t ser_tuned_lock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_once_t ser_tuned_once = PTHREAD_ONCE_INIT;
+
+bool ser_show_stats = false;	// print the I/O statistics of every port on close
+int ser_timeout_ms = SER_TIMEOUT_MS;	// max. silence within a command reply
+
+
+/********************************************************************
+ * tty backend
+ ********************************************************************/
+ssize_t ser_fd_read (struct ser_port *ser, void *buf, size_t len)
+{
+	return read (ser->fd, buf, len);
+}
+
+ssize_t ser_fd_writev (struct ser_port *ser, const struct iovec *iov, int cnt)
+{
+	return writev (ser->fd, iov, cnt);
+}
+
+int ser_fd_poll (struct ser_port *ser, short events, int timeout_ms)
+{
+	struct pollfd pfd;
+	int r;
+
+	pfd.fd = ser->fd;
+	pfd.events = events;
+
+	r = poll (&pfd, 1, timeout_ms);
+
+	return r > 0 ? pfd.revents : r;
+}
+
+/********************************************************************
+ * The cached tty settings have changed
+ *  apply them now or with the end of the batch
+ ********************************************************************/
+static int ser_changed (struct ser_port *ser)
+{
+	ser->tio_dirty = true;
+
+	return ser->tio_batch ? 0 : ser_apply (ser);
+}
+
+static int ser_tty_set_speed (struct ser_port *ser, int baud)
+{
+	if (ser->tio->c_ispeed == baud && ser->tio->c_ospeed == baud)
+	{
+		return 0;
+	}
+
+	ser->tio->c_cflag &= ~CBAUD;
+	ser->tio->c_cflag |= CBAUDEX;
+
+	ser->tio->c_ispeed = baud;
+	ser->tio->c_ospeed = baud;
+
+	return ser_changed (ser);
+}
+
+static void ser_tty_close (struct ser_port *ser)
+{
+	close (ser->fd);
+
+#ifdef __linux__
+	unlock_device (ser->name);
+#endif /* __linux__ */
+}
+
+static const struct ser_ops ser_tty_ops = {
+	"tty",
+	ser_fd_read,
+	ser_fd_writev,
+	ser_fd_poll,
+	ser_tty_set_speed,
+	ser_tty_close
+};
+
+
+/********************************************************************
+ * Open and configure a local serial device
  *
- *  Return 0 = Ok
- *        -1 = Error
+ *  Return the port
+ *         NULL = Error
  ********************************************************************/
-int ser_open (char *serdev, int baud)
+static struct ser_port *ser_tty_open (char *serdev, int baud)
 {
-	int ser;
+	struct ser_port *ser;
 	struct termios2 options;
+	int fd;
 	int r;
 
-	//printf ("Open serial device %s\n", serdev);
-	syslog (LOG_MAKEPRI(LOG_USER, LOG_INFO), "Open serial device %s", serdev);
 	// serial device
 #ifdef __linux__
 	if (lock_device (serdev) < 0)
 	{
 		// Error
 		syslog (LOG_MAKEPRI(LOG_USER, LOG_ERR), "ERROR: device %s is locked", serdev);
-		return -1;
+		return NULL;
 	}
 #endif /* __linux__ */
 
-	if ((ser = open (serdev, O_RDWR | O_NOCTTY)) < 0)
+	if ((fd = open (serdev, O_RDWR | O_NOCTTY)) < 0)
 	{
 		// Error
 		syslog (LOG_MAKEPRI(LOG_USER, LOG_ERR), "ERROR: could not open %s: %s", serdev, strerror (errno));
@@ -78,15 +182,15 @@ int ser_open (char *serdev, int baud)
 #ifdef __linux__
 		unlock_device (serdev);
 #endif /* __linux__ */
-		return -1;
+		return NULL;
 	}
 
-	r = ioctl (ser, TCGETS2, &options);
+	r = ioctl (fd, TCGETS2, &options);
 	if (r < 0)
 	{
 		syslog (LOG_MAKEPRI(LOG_USER, LOG_ERR), "ERROR: TCGETS2 - %s", strerror (errno));
-		close (ser);
-		return -1;
+		close (fd);
+		return NULL;
 	}
 
 	options.c_cc[VTIME] = 0;
@@ -115,394 +219,1252 @@ int ser_open (char *serdev, int baud)
 	options.c_ispeed = baud;
 	options.c_ospeed = baud;
 
-	r = ioctl (ser, TCSETS2, &options);
+	r = ioctl (fd, TCSETS2, &options);
 	if (r < 0)
 	{
 		syslog (LOG_MAKEPRI(LOG_USER, LOG_ERR), "ERROR: TCSETS2 - %s", strerror (errno));
-		close (ser);
-		return -1;
+		close (fd);
+		return NULL;
 	}
 
-	syslog (LOG_MAKEPRI(LOG_USER, LOG_INFO), "serial device %s opened", serdev);
+	ser = calloc (1, sizeof (struct ser_port));
+	if (NULL != ser)
+	{
+		ser->tio = malloc (sizeof (options));
+	}
+	if (NULL == ser || NULL == ser->tio)
+	{
+		free (ser);
+		close (fd);
+		return NULL;
+	}
+	*ser->tio = options;
+	ser->ops = &ser_tty_ops;
+	ser->fd = fd;
 
 	return ser;
 }
 
 
 /********************************************************************
- * ser_close
- *  close a serial device
+ * Is name something ser_open() can open
  ********************************************************************/
-void ser_close (int ser, char *serdev)
+bool ser_is_port (const char *name)
 {
-	close (ser);
-
-#ifdef __linux__
-	unlock_device (serdev);
-#endif /* __linux__ */
-
-	syslog (LOG_MAKEPRI(LOG_USER, LOG_INFO), "serial device %s closed", serdev);
+	return !strncmp (name, "/dev/", 5) ||
+		   !strncmp (name, SER_TCP_PREFIX, strlen (SER_TCP_PREFIX)) ||
+		   !strncmp (name, SER_RFC2217_PREFIX, strlen (SER_RFC2217_PREFIX));
 }
 
 
 /********************************************************************
- * ser_set_baud
- *  set baudrate on a serial device
+ * ser_open
+ *  open a serial device and configure it
+ *  serdev is a tty, tcp://host:port or rfc2217://host:port,
+ *  baud is not applied to tcp://, its speed is set on the server
  *
- *  Return 0 = Ok
- *        -1 = Error
+ *  Return the port
+ *         NULL = Error
  ********************************************************************/
-int ser_set_baud (int ser, int baud)
+struct ser_port *ser_open (char *serdev, int baud)
 {
-	int r;
-	struct termios2 options;
-
-	r = ioctl (ser, TCGETS2, &options);
-	if (r < 0)
-	{
-		syslog (LOG_MAKEPRI(LOG_USER, LOG_ERR), "ERROR: TCGETS2 - %s", strerror (errno));
-		return -1;
-	}
-
-	options.c_cflag &= ~CBAUD;
-	options.c_cflag |= CBAUDEX;
+	struct ser_port *ser;
 
-	options.c_ispeed = baud;
-	options.c_ospeed = baud;
+	//printf ("Open serial device %s\n", serdev);
+	syslog (LOG_MAKEPRI(LOG_USER, LOG_INFO), "Open serial device %s", serdev);
 
-	r = ioctl (ser, TCSETS2, &options);
-	if (r < 0)
+	if (!strncmp (serdev, SER_TCP_PREFIX, strlen (SER_TCP_PREFIX)))
 	{
-		syslog (LOG_MAKEPRI(LOG_USER, LOG_ERR), "ERROR: TCSETS2 - %s", strerror (errno));
-		return -1;
+		ser = ser_tcp_open (serdev + strlen (SER_TCP_PREFIX));
 	}
-
-	return 0;
-}
-
-
-/********************************************************************
- *
- ********************************************************************/
-int ser_set_stopbits (int ser, int stop_bits)
-{
-	struct termios2 options;
-	int r;
-
-	r = ioctl (ser, TCGETS2, &options);
-	if (r < 0)
+	else if (!strncmp (serdev, SER_RFC2217_PREFIX, strlen (SER_RFC2217_PREFIX)))
 	{
-		syslog (LOG_MAKEPRI(LOG_USER, LOG_ERR), "ERROR: TCGETS2 - %s", strerror (errno));
-		return -1;
+		ser = ser_rfc2217_open (serdev + strlen (SER_RFC2217_PREFIX), baud);
 	}
-
-	switch (stop_bits)
+	else
 	{
-		case 1:
-			options.c_cflag &= ~CSTOPB;	// 1 stop bit
-			break;
-
-		case 2:
-			options.c_cflag |= CSTOPB;	// 2 stop bits
-			break;
-
-		default:
-			syslog (LOG_MAKEPRI(LOG_USER, LOG_ERR), "ERROR: unsupported stop bits - %d", stop_bits);
-			return -1;
+		ser = ser_tty_open (serdev, baud);
 	}
 
-	r = ioctl (ser, TCSETS2, &options);
-	if (r < 0)
+	if (NULL == ser)
 	{
-		syslog (LOG_MAKEPRI(LOG_USER, LOG_ERR), "ERROR: TCSETS2 - %s", strerror (errno));
-		return -1;
+		return NULL;
 	}
 
-	return 0;
+	snprintf (ser->name, sizeof (ser->name), "%s", serdev);
+	ser->baud = baud;
+
+	syslog (LOG_MAKEPRI(LOG_USER, LOG_INFO), "serial device %s opened", serdev);
+
+	return ser;
 }
 
 
 /********************************************************************
- *
+ * ser_close
+ *  close a serial device
  ********************************************************************/
-int ser_set_parity (int ser, char parity)
+void ser_close (struct ser_port *ser)
 {
-	struct termios2 options;
-	int r;
-
-	r = ioctl (ser, TCGETS2, &options);
-	if (r < 0)
+	if (ser_show_stats)
 	{
-		syslog (LOG_MAKEPRI(LOG_USER, LOG_ERR), "ERROR: TCGETS2 - %s", strerror (errno));
-		return -1;
+		ser_stats_print (ser);
 	}
 
-	switch (parity)
-	{
-		case 'N':
-		case 'n':
-			options.c_cflag &= ~PARENB;
-			options.c_iflag &= ~INPCK;
-			break;
-
-		case 'E':
-		case 'e':
-			options.c_cflag |= PARENB;
-			options.c_cflag &= ~PARODD;
-			options.c_iflag |= INPCK;
-			break;
-
-		case 'O':
-		case 'o':
-			options.c_cflag |= (PARODD | PARENB);
-			options.c_iflag |= INPCK;
-			break;
-
-		default:
-			return -1;
-	}
+	ser_restore_latency (ser);
+	ser->ops->close (ser);
 
-	r = ioctl (ser, TCSETS2, &options);
-	if (r < 0)
-	{
-		syslog (LOG_MAKEPRI(LOG_USER, LOG_ERR), "ERROR: TCSETS2 - %s", strerror (errno));
-		return -1;
-	}
+	syslog (LOG_MAKEPRI(LOG_USER, LOG_INFO), "serial device %s closed", ser->name);
 
-	return 0;
+	free (ser->tio);
+	free (ser);
 }
 
 
 /********************************************************************
- *
+ * Print the I/O statistics of a port
+ *  in one block, ports of parallel updates do not mix
  ********************************************************************/
-void ser_set_dtr (int ser, int i)
+void ser_stats_print (const struct ser_port *ser)
 {
-	int bit = TIOCM_DTR;
-
-	if (i)
-	{
-		ioctl (ser, TIOCMBIS, &bit);	// set DTR
-	}
-	else
+	const struct ser_stats *st = &ser->stats;
+
+	flockfile (stdout);
+	printf ("%s: %" PRIu64 " byte in, %" PRIu64 " byte out, %" PRIu64 " reads, %" PRIu64 " writes, "
+			"%" PRIu64 " short reads, %" PRIu64 " timeouts\n",
+			ser->name, st->bytes_in, st->bytes_out, st->reads, st->writes,
+			st->short_reads, st->timeouts);
+	if (st->read_us.total)
 	{
-		ioctl (ser, TIOCMBIC, &bit);	// clear DTR
+		printf ("%s: read latency p50 %" PRIu64 " us, p90 %" PRIu64 " us, p99 %" PRIu64 " us, max %" PRIu64 " us\n",
+				ser->name,
+				hist_percentile (&st->read_us, 50),
+				hist_percentile (&st->read_us, 90),
+				hist_percentile (&st->read_us, 99),
+				st->read_us.max);
 	}
+	funlockfile (stdout);
 }
 
 
 /********************************************************************
- *
+ * Put back the latency settings of one slot
+ *  only uses async-signal-safe calls
  ********************************************************************/
-void ser_set_rts (int ser, int i)
+static void ser_latency_undo (struct ser_latency *t)
 {
-	int bit = TIOCM_RTS;
+	struct serial_struct ss;
+	char buf[16];
+	int fd;
+	int n;
 
-	if (i)
+	if (t->timer >= 0 && (fd = open (t->path, O_WRONLY)) >= 0)
 	{
-		ioctl (ser, TIOCMBIS, &bit);	// set RTS
+		// no snprintf here, this runs in signal handlers
+		n = sizeof (buf);
+		buf[--n] = '\n';
+		do
+		{
+			buf[--n] = '0' + t->timer % 10;
+			t->timer /= 10;
+		}
+		while (t->timer && n);
+		write (fd, buf + n, sizeof (buf) - n);
+		close (fd);
 	}
-	else
+
+	if (t->flags >= 0 && 0 == ioctl (t->ser, TIOCGSERIAL, &ss))
 	{
-		ioctl (ser, TIOCMBIC, &bit);	// clear RTS
+		ss.flags = t->flags;
+		ioctl (t->ser, TIOCSSERIAL, &ss);
 	}
-}
 
+	t->timer = -1;
+	t->flags = -1;
+	t->ser = -1;
+}
 
 /********************************************************************
- *
+ * Lock the table of tuned ports
+ *  the restoring signals are blocked while the lock is held, so the
+ *  handler never waits for a lock its own thread holds
  ********************************************************************/
-int ser_get_dcd (int ser)
+static void ser_tuned_enter (sigset_t *old)
 {
-	int status;
+	sigset_t set;
 
-	ioctl (ser, TIOCMGET, &status);
+	sigemptyset (&set);
+	sigaddset (&set, SIGINT);
+	sigaddset (&set, SIGTERM);
+	sigaddset (&set, SIGHUP);
+	sigaddset (&set, SIGQUIT);
+	pthread_sigmask (SIG_BLOCK, &set, old);
 
-	return (status & TIOCM_CAR);
+	pthread_mutex_lock (&ser_tuned_lock);
 }
 
+static void ser_tuned_leave (const sigset_t *old)
+{
+	pthread_mutex_unlock (&ser_tuned_lock);
+	pthread_sigmask (SIG_SETMASK, old, NULL);
+}
 
 /********************************************************************
- *
+ * Put back the latency settings of all ports
  ********************************************************************/
-int ser_get_ri (int ser)
+static void ser_restore_all (void)
 {
-	int status;
-
-	ioctl (ser, TIOCMGET, &status);
+	sigset_t old;
+	int i;
 
-	return (status & TIOCM_RNG);
+	ser_tuned_enter (&old);
+	for (i = 0; i < SER_MAX_TUNED; i++)
+	{
+		if (ser_tuned[i].ser >= 0)
+		{
+			ser_latency_undo (&ser_tuned[i]);
+		}
+	}
+	ser_tuned_leave (&old);
 }
 
-
 /********************************************************************
- *
+ * Fatal signals restore the ports and then do what they would do
  ********************************************************************/
-int ser_get_dsr (int ser)
+static void ser_latency_signal (int sig)
 {
-	int status;
-
-	ioctl (ser, TIOCMGET, &status);
+	ser_restore_all ();
 
-	return (status & TIOCM_DSR);
+	signal (sig, SIG_DFL);
+	raise (sig);
 }
 
-
 /********************************************************************
- *
+ * Make sure the ports are restored on every way out
  ********************************************************************/
-int ser_get_cts (int ser)
+static void ser_latency_hooks (void)
 {
-	int status;
+	static const int sigs[] = { SIGINT, SIGTERM, SIGHUP, SIGQUIT };
+	struct sigaction sa;
+	int i;
 
-	ioctl (ser, TIOCMGET, &status);
+	for (i = 0; i < SER_MAX_TUNED; i++)
+	{
+		ser_tuned[i].ser = -1;
+	}
 
-	return (status & TIOCM_CTS);
-}
+	atexit (ser_restore_all);
 
+	for (i = 0; i < sizeof (sigs) / sizeof (sigs[0]); i++)
+	{
+		if (0 == sigaction (sigs[i], NULL, &sa) && SIG_DFL == sa.sa_handler)
+		{
+			signal (sigs[i], ser_latency_signal);
+		}
+	}
+}
 
 /********************************************************************
- * Flush serial port
- * Return:
- *  number of flushed bytes
- *  negative = Error
+ * Low latency mode for an update
+ *  sets the FTDI latency timer of the port to SER_LATENCY_TIMER ms
+ *  and ASYNC_LOW_LATENCY, until ser_restore_latency() or ser_close()
+ *  (or exit or a fatal signal) puts back the old values
+ *
+ *  Return 0 = Ok, at least one setting changed
+ *        -1 = nothing could be changed
  ********************************************************************/
-int ser_flush (int ser)
+int ser_low_latency (struct ser_port *ser)
 {
-	int flushed = 0;
-	struct termios2 options;
-	int r;
-	char c;
+	struct ser_latency *t = NULL;
+	struct serial_struct ss;
+	const char *name;
+	sigset_t old;
+	char buf[16];
+	int fd;
+	int n;
+	int i;
 
-	r = ioctl (ser, TCGETS2, &options);
-	if (r < 0)
+	if (&ser_tty_ops != ser->ops)
 	{
-		syslog (LOG_MAKEPRI(LOG_USER, LOG_ERR), "ERROR: TCGETS2 - %s", strerror (errno));
-		close (ser);
-		return -1;
+		return -1;	// nothing to tune on a network port
 	}
 
-	options.c_cc[VTIME] = 2;	// 200 ms timeout
-	options.c_cc[VMIN] = 0;
+	pthread_once (&ser_tuned_once, ser_latency_hooks);
 
-	r = ioctl (ser, TCSETS2, &options);
-	if (r < 0)
+	ser_tuned_enter (&old);
+	for (i = 0; i < SER_MAX_TUNED && !t; i++)
+	{
+		if (ser_tuned[i].ser < 0)
+		{
+			t = &ser_tuned[i];
+			t->timer = -1;
+			t->flags = -1;
+			t->ser = ser->fd;
+		}
+	}
+	ser_tuned_leave (&old);
+
+	if (NULL == t)
 	{
-		syslog (LOG_MAKEPRI(LOG_USER, LOG_ERR), "ERROR: TCSETS2 - %s", strerror (errno));
-		close (ser);
 		return -1;
 	}
 
-	do
+	// the FTDI driver holds received data back for up to latency_timer ms
+	name = strrchr (ser->name, '/');
+	name = name ? name + 1 : ser->name;
+	snprintf (t->path, sizeof (t->path), "/sys/bus/usb-serial/devices/%s/latency_timer", name);
+
+	fd = open (t->path, O_RDWR);
+	if (fd >= 0)
+	{
+		n = read (fd, buf, sizeof (buf) - 1);
+		if (n > 0)
+		{
+			buf[n] = '\0';
+			i = strtol (buf, NULL, 10);
+			n = snprintf (buf, sizeof (buf), "%d\n", SER_LATENCY_TIMER);
+			if (i > SER_LATENCY_TIMER && write (fd, buf, n) == n)
+			{
+				t->timer = i;
+				syslog (LOG_MAKEPRI(LOG_USER, LOG_INFO), "%s: latency timer %d -> %d ms", ser->name, i, SER_LATENCY_TIMER);
+			}
+		}
+		close (fd);
+	}
+	else if (EACCES == errno)
 	{
-		r = read (ser, &c, 1);
-		flushed += r;
+		syslog (LOG_MAKEPRI(LOG_USER, LOG_INFO), "%s: no permission to change the latency timer", ser->name);
 	}
-	while (r > 0);
 
-	options.c_cc[VTIME] = 0;
-	options.c_cc[VMIN] = 1;	// block and read 1 char
+	// and the tty layer hands it on without delay
+	if (0 == ioctl (ser->fd, TIOCGSERIAL, &ss) && !(ss.flags & ASYNC_LOW_LATENCY))
+	{
+		i = ss.flags;
+		ss.flags |= ASYNC_LOW_LATENCY;
+		if (0 == ioctl (ser->fd, TIOCSSERIAL, &ss))
+		{
+			t->flags = i;
+		}
+	}
 
-	r = ioctl (ser, TCSETS2, &options);
-	if (r < 0)
+	if (t->timer < 0 && t->flags < 0)
 	{
-		syslog (LOG_MAKEPRI(LOG_USER, LOG_ERR), "ERROR: TCSETS2 - %s", strerror (errno));
-		close (ser);
+		ser_tuned_enter (&old);
+		t->ser = -1;
+		ser_tuned_leave (&old);
 		return -1;
 	}
+	ser->tuned = true;
 
-	return flushed;
+	return 0;
 }
 
-
 /********************************************************************
- * Wait for a given string
- *
- * Return 0 = Ok
- *       -1 = Error
+ * Put back what ser_low_latency() changed on this port
  ********************************************************************/
-int ser_wait (int ser, const char *cmd)
+void ser_restore_latency (struct ser_port *ser)
 {
-	ssize_t r;
-	char c;
-	int x;
-	int l;
-	int run;
+	sigset_t old;
+	int i;
 
-	l = strlen (cmd);
-	run = 1;
-	x = 0;
-	while (run)
+	if (!ser->tuned)
 	{
-		r = read (ser, &c, 1);
-		if (0 == r)
+		return;
+	}
+	ser->tuned = false;
+
+	ser_tuned_enter (&old);
+	for (i = 0; i < SER_MAX_TUNED; i++)
+	{
+		if (ser_tuned[i].ser == ser->fd)
 		{
-			syslog (LOG_MAKEPRI (LOG_USER, LOG_ERR), "ERROR: timeout occured. Waiting for: %s", cmd);
-			return -1;
+			ser_latency_undo (&ser_tuned[i]);
 		}
-		if (c == cmd[x])
-		{
-			x++;
-			if (x == l)
+	}
+	ser_tuned_leave (&old);
+}
+
+
+/********************************************************************
+ * Collect the following settings until ser_apply()
+ ********************************************************************/
+void ser_batch (struct ser_port *ser)
+{
+	ser->tio_batch = true;
+}
+
+
+/********************************************************************
+ * Apply the cached tty settings with one ioctl
+ *  and end a batch
+ *
+ *  Return 0 = Ok
+ *        -1 = Error
+ ********************************************************************/
+int ser_apply (struct ser_port *ser)
+{
+	ser->tio_batch = false;
+
+	if (NULL == ser->tio || !ser->tio_dirty)
+	{
+		return 0;
+	}
+
+	if (ioctl (ser->fd, TCSETS2, ser->tio) < 0)
+	{
+		syslog (LOG_MAKEPRI(LOG_USER, LOG_ERR), "ERROR: TCSETS2 - %s", strerror (errno));
+		return -1;
+	}
+	ser->tio_dirty = false;
+
+	return 0;
+}
+
+
+/********************************************************************
+ * ser_set_baud
+ *  set baudrate on a serial device
+ *
+ *  Return 0 = Ok
+ *        -1 = Error
+ ********************************************************************/
+int ser_set_baud (struct ser_port *ser, int baud)
+{
+	if (NULL == ser->ops->set_speed)
+	{
+		syslog (LOG_MAKEPRI(LOG_USER, LOG_ERR), "ERROR: speed of %s cannot be changed", ser->name);
+		return -1;
+	}
+
+	if (ser->ops->set_speed (ser, baud))
+	{
+		return -1;
+	}
+	ser->baud = baud;
+
+	return 0;
+}
+
+
+/********************************************************************
+ *
+ ********************************************************************/
+int ser_set_stopbits (struct ser_port *ser, int stop_bits)
+{
+	unsigned cflag;
+
+	if (NULL == ser->tio)
+	{
+		syslog (LOG_MAKEPRI(LOG_USER, LOG_ERR), "ERROR: stop bits of %s cannot be changed", ser->name);
+		return -1;
+	}
+
+	cflag = ser->tio->c_cflag;
+	switch (stop_bits)
+	{
+		case 1:
+			cflag &= ~CSTOPB;	// 1 stop bit
+			break;
+
+		case 2:
+			cflag |= CSTOPB;	// 2 stop bits
+			break;
+
+		default:
+			syslog (LOG_MAKEPRI(LOG_USER, LOG_ERR), "ERROR: unsupported stop bits - %d", stop_bits);
+			return -1;
+	}
+
+	if (cflag == ser->tio->c_cflag)
+	{
+		return 0;
+	}
+	ser->tio->c_cflag = cflag;
+
+	return ser_changed (ser);
+}
+
+
+/********************************************************************
+ *
+ ********************************************************************/
+int ser_set_parity (struct ser_port *ser, char parity)
+{
+	unsigned cflag, iflag;
+
+	if (NULL == ser->tio)
+	{
+		syslog (LOG_MAKEPRI(LOG_USER, LOG_ERR), "ERROR: parity of %s cannot be changed", ser->name);
+		return -1;
+	}
+
+	cflag = ser->tio->c_cflag;
+	iflag = ser->tio->c_iflag;
+	switch (parity)
+	{
+		case 'N':
+		case 'n':
+			cflag &= ~PARENB;
+			iflag &= ~INPCK;
+			break;
+
+		case 'E':
+		case 'e':
+			cflag |= PARENB;
+			cflag &= ~PARODD;
+			iflag |= INPCK;
+			break;
+
+		case 'O':
+		case 'o':
+			cflag |= (PARODD | PARENB);
+			iflag |= INPCK;
+			break;
+
+		default:
+			return -1;
+	}
+
+	if (cflag == ser->tio->c_cflag && iflag == ser->tio->c_iflag)
+	{
+		return 0;
+	}
+	ser->tio->c_cflag = cflag;
+	ser->tio->c_iflag = iflag;
+
+	return ser_changed (ser);
+}
+
+
+/********************************************************************
+ *
+ ********************************************************************/
+void ser_set_dtr (struct ser_port *ser, int i)
+{
+	int bit = TIOCM_DTR;
+
+	if (i)
+	{
+		ioctl (ser->fd, TIOCMBIS, &bit);	// set DTR
+	}
+	else
+	{
+		ioctl (ser->fd, TIOCMBIC, &bit);	// clear DTR
+	}
+}
+
+
+/********************************************************************
+ *
+ ********************************************************************/
+void ser_set_rts (struct ser_port *ser, int i)
+{
+	int bit = TIOCM_RTS;
+
+	if (i)
+	{
+		ioctl (ser->fd, TIOCMBIS, &bit);	// set RTS
+	}
+	else
+	{
+		ioctl (ser->fd, TIOCMBIC, &bit);	// clear RTS
+	}
+}
+
+
+/********************************************************************
+ *
+ ********************************************************************/
+int ser_get_dcd (struct ser_port *ser)
+{
+	int status;
+
+	ioctl (ser->fd, TIOCMGET, &status);
+
+	return (status & TIOCM_CAR);
+}
+
+
+/********************************************************************
+ *
+ ********************************************************************/
+int ser_get_ri (struct ser_port *ser)
+{
+	int status;
+
+	ioctl (ser->fd, TIOCMGET, &status);
+
+	return (status & TIOCM_RNG);
+}
+
+
+/********************************************************************
+ *
+ ********************************************************************/
+int ser_get_dsr (struct ser_port *ser)
+{
+	int status;
+
+	ioctl (ser->fd, TIOCMGET, &status);
+
+	return (status & TIOCM_DSR);
+}
+
+
+/********************************************************************
+ *
+ ********************************************************************/
+int ser_get_cts (struct ser_port *ser)
+{
+	int status;
+
+	ioctl (ser->fd, TIOCMGET, &status);
+
+	return (status & TIOCM_CTS);
+}
+
+
+/********************************************************************
+ * Monotonic clock in ms
+ ********************************************************************/
+long long ser_now_ms (void)
+{
+	struct timespec ts;
+
+	clock_gettime (CLOCK_MONOTONIC, &ts);
+
+	return (long long) ts.tv_sec * 1000 + ts.tv_nsec / 1000000;
+}
+
+
+/********************************************************************
+ * Receive ring
+ *  bytes read in bulk from the port, consumed by the functions below
+ ********************************************************************/
+static inline size_t ser_buffered (const struct ser_port *ser)
+{
+	return ser->rx_tail - ser->rx_head;
+}
+
+/********************************************************************
+ * Copy up to len buffered bytes to buf
+ *  Return number of bytes
+ ********************************************************************/
+static size_t ser_take (struct ser_port *ser, void *buf, size_t len)
+{
+	size_t off = ser->rx_head & (SER_RX_SIZE - 1);
+	size_t n = ser_buffered (ser);
+	size_t first;
+
+	if (n > len)
+	{
+		n = len;
+	}
+
+	first = SER_RX_SIZE - off;
+	if (first > n)
+	{
+		first = n;
+	}
+	memcpy (buf, ser->rx + off, first);
+	memcpy ((uint8_t *) buf + first, ser->rx, n - first);
+	ser->rx_head += n;
+
+	return n;
+}
+
+
+/********************************************************************
+ * One read or write syscall, counted
+ ********************************************************************/
+static ssize_t ser_io_read (struct ser_port *ser, void *buf, size_t len)
+{
+	ssize_t n;
+
+	n = ser->ops->read (ser, buf, len);
+	ser->stats.reads++;
+	if (n > 0)
+	{
+		ser->stats.bytes_in += n;
+	}
+
+	return n;
+}
+
+ssize_t ser_writev (struct ser_port *ser, const struct iovec *iov, int cnt)
+{
+	ssize_t n;
+
+	n = ser->ops->writev (ser, iov, cnt);
+	ser->stats.writes++;
+	if (n > 0)
+	{
+		ser->stats.bytes_out += n;
+	}
+
+	return n;
+}
+
+
+/********************************************************************
+ * Read from the port, buffered bytes first
+ *  same semantics as ser->ops->read
+ ********************************************************************/
+ssize_t ser_read (struct ser_port *ser, void *buf, size_t len)
+{
+	if (ser_buffered (ser))
+	{
+		return ser_take (ser, buf, len);
+	}
+
+	return ser_io_read (ser, buf, len);
+}
+
+
+/********************************************************************
+ * Poll the port, buffered bytes count as POLLIN
+ *  same semantics as ser->ops->poll
+ ********************************************************************/
+int ser_poll_ms (struct ser_port *ser, short events, int timeout_ms)
+{
+	int r;
+
+	if ((events & POLLIN) && ser_buffered (ser))
+	{
+		r = ser->ops->poll (ser, events & ~POLLIN, 0);
+		return (r > 0 ? r : 0) | POLLIN;
+	}
+
+	return ser->ops->poll (ser, events, timeout_ms);
+}
+
+
+/********************************************************************
+ * Wait until the port is ready or the deadline has passed
+ *
+ *  Return 1 = ready
+ *         0 = timeout
+ *        -1 = Error
+ ********************************************************************/
+static int ser_poll (struct ser_port *ser, short events, long long deadline)
+{
+	long long left;
+	int r;
+
+	if ((events & POLLIN) && ser_buffered (ser))
+	{
+		return 1;
+	}
+
+	for (;;)
+	{
+		left = deadline - ser_now_ms ();
+		if (left < 0)
+		{
+			left = 0;
+		}
+
+		r = ser->ops->poll (ser, events, left);
+		if (r > 0)
+		{
+			if (r & (POLLERR | POLLNVAL))
+			{
+				return -1;
+			}
+			return 1;
+		}
+		if (0 == r)
+		{
+			return 0;
+		}
+		if (EINTR != errno)
+		{
+			syslog (LOG_MAKEPRI(LOG_USER, LOG_ERR), "ERROR: poll - %s", strerror (errno));
+			return -1;
+		}
+	}
+}
+
+
+/********************************************************************
+ * Fill the empty receive ring with what has arrived
+ *  one read for everything the port has, waits until the deadline
+ *  if nothing is there
+ *
+ *  Return 0 = Ok
+ *        -1 = Error or timeout (errno = ETIMEDOUT)
+ ********************************************************************/
+static int ser_fill (struct ser_port *ser, long long deadline)
+{
+	long long start = timing_now_ns ();
+	size_t off;
+	size_t room;
+	ssize_t n;
+	int r;
+
+	for (;;)
+	{
+		r = ser_poll (ser, POLLIN, deadline);
+		if (r <= 0)
+		{
+			if (0 == r)
+			{
+				errno = ETIMEDOUT;
+				ser->stats.timeouts++;
+			}
+			return -1;
+		}
+
+		// contiguous free space
+		off = ser->rx_tail & (SER_RX_SIZE - 1);
+		room = SER_RX_SIZE - ser_buffered (ser);
+		if (room > SER_RX_SIZE - off)
+		{
+			room = SER_RX_SIZE - off;
+		}
+		if (0 == room)
+		{
+			return 0;
+		}
+
+		n = ser_io_read (ser, ser->rx + off, room);
+		if (n < 0)
+		{
+			if (EINTR == errno || EAGAIN == errno)
+			{
+				continue;
+			}
+			syslog (LOG_MAKEPRI(LOG_USER, LOG_ERR), "ERROR: read - %s", strerror (errno));
+			return -1;
+		}
+		if (0 == n)
+		{
+			// hang up
+			errno = EIO;
+			return -1;
+		}
+
+		ser->rx_tail += n;
+		hist_add (&ser->stats.read_us, (timing_now_ns () - start) / 1000);
+		return 0;
+	}
+}
+
+
+/********************************************************************
+ * Next received byte before an absolute deadline
+ *
+ *  Return 0 = Ok
+ *        -1 = Error or timeout (errno = ETIMEDOUT)
+ ********************************************************************/
+static int ser_getc (struct ser_port *ser, char *c, long long deadline)
+{
+	if (0 == ser_buffered (ser) && ser_fill (ser, deadline))
+	{
+		return -1;
+	}
+
+	*c = ser->rx[ser->rx_head++ & (SER_RX_SIZE - 1)];
+
+	return 0;
+}
+
+
+/********************************************************************
+ * Read exactly len bytes before an absolute deadline
+ *  buffered bytes first, the rest directly from the port
+ *
+ *  Return 0 = Ok
+ *        -1 = Error or timeout (errno = ETIMEDOUT)
+ ********************************************************************/
+static int ser_read_deadline (struct ser_port *ser, void *buf, size_t len, long long deadline)
+{
+	long long start = timing_now_ns ();
+	uint8_t *p = buf;
+	size_t got;
+	ssize_t n;
+	int r;
+
+	got = ser_take (ser, p, len);
+	p += got;
+	len -= got;
+
+	while (len)
+	{
+		r = ser_poll (ser, POLLIN, deadline);
+		if (r <= 0)
+		{
+			if (0 == r)
+			{
+				errno = ETIMEDOUT;
+				ser->stats.timeouts++;
+			}
+			return -1;
+		}
+
+		n = ser_io_read (ser, p, len);
+		if (n < 0)
+		{
+			if (EINTR == errno || EAGAIN == errno)
+			{
+				continue;
+			}
+			syslog (LOG_MAKEPRI(LOG_USER, LOG_ERR), "ERROR: read - %s", strerror (errno));
+			return -1;
+		}
+		if (0 == n)
+		{
+			// hang up
+			errno = EIO;
+			return -1;
+		}
+
+		if ((size_t) n < len)
+		{
+			ser->stats.short_reads++;
+		}
+		p += n;
+		len -= n;
+		if (0 == len)
+		{
+			hist_add (&ser->stats.read_us, (timing_now_ns () - start) / 1000);
+		}
+	}
+
+	return 0;
+}
+
+
+/********************************************************************
+ * Read exactly len bytes within deadline_ms
+ *
+ *  Return 0 = Ok
+ *        -1 = Error or timeout (errno = ETIMEDOUT)
+ ********************************************************************/
+int ser_read_exact (struct ser_port *ser, void *buf, size_t len, int deadline_ms)
+{
+	return ser_read_deadline (ser, buf, len, ser_now_ms () + deadline_ms);
+}
+
+
+/********************************************************************
+ * Write all vectors within deadline_ms,
+ * continue after partial writes
+ *
+ *  Return 0 = Ok
+ *        -1 = Error or timeout (errno = ETIMEDOUT)
+ ********************************************************************/
+int ser_writev_all (struct ser_port *ser, struct iovec *iov, int cnt, int deadline_ms)
+{
+	long long deadline = ser_now_ms () + deadline_ms;
+	ssize_t n;
+	int r;
+
+	while (cnt)
+	{
+		n = ser_writev (ser, iov, cnt);
+		if (n < 0)
+		{
+			if (EINTR == errno)
+			{
+				continue;
+			}
+			if (EAGAIN != errno)
+			{
+				syslog (LOG_MAKEPRI(LOG_USER, LOG_ERR), "ERROR: write - %s", strerror (errno));
+				return -1;
+			}
+
+			// output buffer full, wait for room
+			r = ser_poll (ser, POLLOUT, deadline);
+			if (r <= 0)
+			{
+				if (0 == r)
+				{
+					errno = ETIMEDOUT;
+					ser->stats.timeouts++;
+				}
+				return -1;
+			}
+			continue;
+		}
+
+		while (cnt && (size_t) n >= iov->iov_len)
+		{
+			n -= iov->iov_len;
+			iov++;
+			cnt--;
+		}
+		if (cnt)
+		{
+			iov->iov_base = (uint8_t *) iov->iov_base + n;
+			iov->iov_len -= n;
+
+			if (ser_now_ms () > deadline)
+			{
+				errno = ETIMEDOUT;
+				ser->stats.timeouts++;
+				return -1;
+			}
+		}
+	}
+
+	return 0;
+}
+
+
+/********************************************************************
+ * Write len bytes within deadline_ms
+ *
+ *  Return 0 = Ok
+ *        -1 = Error or timeout (errno = ETIMEDOUT)
+ ********************************************************************/
+int ser_write_all (struct ser_port *ser, const void *buf, size_t len, int deadline_ms)
+{
+	struct iovec iov;
+
+	iov.iov_base = (void *) buf;
+	iov.iov_len = len;
+
+	return ser_writev_all (ser, &iov, 1, deadline_ms);
+}
+
+
+/********************************************************************
+ * Drain the input until the modem is quiet
+ *  reads and discards everything until pattern (if not NULL) has
+ *  been seen and then nothing arrived for idle_ms
+ *
+ * Return:
+ *  number of discarded bytes
+ *  negative = Error, or nothing at all received within deadline_ms
+ *             while waiting for the pattern
+ ********************************************************************/
+int ser_drain (struct ser_port *ser, const char *pattern, int idle_ms, int deadline_ms)
+{
+	struct match_set m;
+	long long deadline;
+	long long quiet;
+	char buf[256];
+	int drained = 0;
+	bool found;
+	int state = 0;
+	ssize_t n;
+	ssize_t i;
+	int r;
+
+	found = (NULL == pattern);
+	if (!found && match_init (&m, &pattern, 1))
+	{
+		return -1;
+	}
+	deadline = ser_now_ms () + deadline_ms;
+
+	for (;;)
+	{
+		quiet = ser_now_ms () + idle_ms;
+		if (!found || quiet > deadline)
+		{
+			// still waiting for the pattern, only the deadline counts
+			quiet = deadline;
+		}
+
+		r = ser_poll (ser, POLLIN, quiet);
+		if (r < 0)
+		{
+			return -1;
+		}
+		if (0 == r)
+		{
+			if (!found && 0 == drained)
+			{
+				ser->stats.timeouts++;
+				syslog (LOG_MAKEPRI (LOG_USER, LOG_ERR), "ERROR: timeout occured. Waiting for: %s", pattern);
+				return -1;
+			}
+			return drained;
+		}
+
+		n = ser_read (ser, buf, sizeof (buf));
+		if (n < 0)
+		{
+			if (EINTR == errno || EAGAIN == errno)
+			{
+				continue;
+			}
+			return -1;
+		}
+		if (0 == n)
+		{
+			return -1;
+		}
+		drained += n;
+
+		for (i = 0; i < n && !found; i++)
+		{
+			found = match_step (&m, &state, buf[i]) >= 0;
+		}
+	}
+}
+
+
+/********************************************************************
+ * Flush serial port
+ *  discard what is buffered and wait for SER_IDLE_MS of silence
+ * Return:
+ *  number of flushed bytes
+ *  negative = Error
+ ********************************************************************/
+int ser_flush (struct ser_port *ser)
+{
+	ioctl (ser->fd, TCFLSH, TCIFLUSH);
+	ser->rx_head = ser->rx_tail;
+
+	return ser_drain (ser, NULL, SER_IDLE_MS, SER_TIMEOUT_MS);
+}
+
+
+/********************************************************************
+ * Wait for the first of several patterns
+ *  the received chars run through the matcher m, the current line
+ *  is collected in line (without CR LF, may be NULL)
+ *  patterns with a leading MATCH_LINE only match at the start of a
+ *  line and complete with the end of that line, all others complete
+ *  with their last char
+ *  gives up after ser_timeout_ms without a char
+ *  bytes after the match stay buffered for the next call
+ *
+ * Return index of the pattern
+ *        -1 = Error or timeout
+ ********************************************************************/
+int ser_expect (struct ser_port *ser, const struct match_set *m, char *line, size_t size)
+{
+	long long deadline;
+	int state;
+	int pending = -1;
+	size_t len = 0;
+	char c;
+	int r;
+
+	state = match_start (m);
+	for (;;)
+	{
+		deadline = ser_now_ms () + ser_timeout_ms;
+		if (ser_getc (ser, &c, deadline))
+		{
+			return -1;
+		}
+
+		if (c == '\n')
+		{
+			if (pending >= 0)
+			{
+				return pending;
+			}
+			len = 0;
+		}
+		else if (line && c != '\r' && len < size - 1)
+		{
+			line[len++] = c;
+		}
+		if (line)
+		{
+			line[len] = '\0';
+		}
+
+		r = match_step (m, &state, c);
+		if (r >= 0)
+		{
+			if (!m->line[r])
 			{
-				run = 0;
+				return r;
 			}
+			pending = r;
 		}
-		else
+	}
+}
+
+
+/********************************************************************
+ * Wait for a given string
+ *  gives up after idle_ms without a char
+ *  bytes after the string stay buffered for the next call
+ *
+ * Return 0 = Ok
+ *       -1 = Error
+ ********************************************************************/
+int ser_wait_ms (struct ser_port *ser, const char *cmd, int idle_ms)
+{
+	struct match_set m;
+	int state = 0;
+	char c;
+
+	if (match_init (&m, &cmd, 1))
+	{
+		return -1;
+	}
+
+	do
+	{
+		if (ser_getc (ser, &c, ser_now_ms () + idle_ms))
 		{
-			x = 0;
+			syslog (LOG_MAKEPRI (LOG_USER, LOG_ERR), "ERROR: timeout occured. Waiting for: %s", cmd);
+			return -1;
 		}
 	}
+	while (match_step (&m, &state, c) < 0);
+
 	return 0;
 }
 
+int ser_wait (struct ser_port *ser, const char *cmd)
+{
+	return ser_wait_ms (ser, cmd, ser_timeout_ms);
+}
+
 
 /********************************************************************
  * wait for a given string
  * and return every captured line
+ *  gives up after ser_timeout_ms without a char
+ *  bytes after the line stay buffered for the next call
+ *
+ * Return length of the line
+ *         0 = string found
+ *        -1 = Error or timeout
  ********************************************************************/
-int ser_getwait (int ser, const char *cmd, char *p)
+int ser_getwait (struct ser_port *ser, const char *cmd, char *p)
 {
-	ssize_t r;
+	struct match_set m;
+	long long deadline;
+	int state = 0;
 	char c;
-	int x;
-	int l;
-	int run;
-	int i;
+	int i = 0;
 
-	l = strlen (cmd);
-	run = 1;
-	x = 0;
-	i = 0;
-	while (run)
+	if (match_init (&m, &cmd, 1))
 	{
-		r = read (ser, &c, 1);
-		if (0 == r)
+		return -1;
+	}
+
+	for (;;)
+	{
+		deadline = ser_now_ms () + ser_timeout_ms;
+		if (ser_getc (ser, &c, deadline))
 		{
 			syslog (LOG_MAKEPRI (LOG_USER, LOG_ERR), "ERROR: timeout occured. Waiting for: %s", cmd);
 			return -1;
 		}
 		*p++ = c;
 		i++;
-		if (c == cmd[x])
+		if (match_step (&m, &state, c) >= 0)
 		{
-			x++;
-			if (x == l)
-			{
-				run = 0;
-				i = 0;
-			}
+			return 0;
 		}
-		else
+		if (c == '\n')
 		{
-			x = 0;
-			if (c == '\n')
-			{
-				run = 0;
-				p -= 2;
-				*p = '\0';
-			}
+			p -= 2;
+			*p = '\0';
+			return i;
 		}
 	}
-	return i;
 }
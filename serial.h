@@ -29,24 +29,124 @@
 
 #pragma once
 
+/********************************************************************
+ * Include files
+ ********************************************************************/
+#include <stddef.h>
+#include <stdint.h>
+#include <stdbool.h>
+#include <sys/types.h>
+#include <sys/uio.h>
+
+#include "match.h"
+#include "timing.h"
+
+
+/********************************************************************
+ * Defines
+ ********************************************************************/
+#define SER_TIMEOUT_MS	500		// default max. silence within a command reply
+#define SER_IDLE_MS		50		// silence that counts as "modem is quiet"
+#define SER_LATENCY_TIMER	1	// ms, FTDI latency timer during an update
+#define SER_MAX_TUNED	16		// ports in low latency mode at the same time
+#define SER_NAME_MAX	272		// device path or host:port
+#define SER_RX_SIZE		4096	// receive ring, power of two
+
+#define SER_TCP_PREFIX		"tcp://"		// raw TCP, e.g. tcp://host:4001
+#define SER_RFC2217_PREFIX	"rfc2217://"	// Telnet COM port control
+
+
+/********************************************************************
+ * Types
+ ********************************************************************/
+struct ser_port;
+struct termios2;
+
+struct ser_ops {
+	const char *name;
+	ssize_t (*read) (struct ser_port *ser, void *buf, size_t len);
+	ssize_t (*writev) (struct ser_port *ser, const struct iovec *iov, int cnt);
+	int (*poll) (struct ser_port *ser, short events, int timeout_ms);	// revents, 0 = timeout, -1 = Error
+	int (*set_speed) (struct ser_port *ser, int baud);					// NULL = speed is fixed
+	void (*close) (struct ser_port *ser);
+};
+
+struct ser_stats {
+	uint64_t bytes_in;
+	uint64_t bytes_out;
+	uint64_t reads;				// read syscalls
+	uint64_t writes;			// write syscalls
+	uint64_t short_reads;		// an exact read needed another syscall
+	uint64_t timeouts;
+	struct histogram read_us;	// wait for data until it was read
+};
+
+struct ser_port {
+	const struct ser_ops *ops;
+	int fd;
+	char name[SER_NAME_MAX];	// as given to ser_open()
+	int baud;
+	int idle_ms;				// min. silence that means the modem is quiet
+	int telnet;					// RFC 2217 receive state
+	uint8_t telnet_cmd;			// RFC 2217 command in progress
+	uint8_t rx[SER_RX_SIZE];	// received, not yet consumed
+	unsigned rx_head;			// next byte to consume, free running
+	unsigned rx_tail;			// next free slot, free running
+	struct termios2 *tio;		// cached tty settings, NULL = no tty
+	bool tio_dirty;				// cache changed, not yet applied
+	bool tio_batch;				// collect changes until ser_apply()
+	bool tuned;					// ser_low_latency() changed the port
+	struct ser_stats stats;
+};
+
+
+/********************************************************************
+ * Global variables
+ ********************************************************************/
+extern bool ser_show_stats;
+extern int ser_timeout_ms;
+
+
 /********************************************************************
  * Function prototypes
  ********************************************************************/
-int ser_open (char *serdev, int baud);
-void ser_close (int ser, char *serdev);
+struct ser_port *ser_open (char *serdev, int baud);
+void ser_close (struct ser_port *ser);
+void ser_stats_print (const struct ser_port *ser);
+bool ser_is_port (const char *name);
+
+ssize_t ser_fd_read (struct ser_port *ser, void *buf, size_t len);
+ssize_t ser_fd_writev (struct ser_port *ser, const struct iovec *iov, int cnt);
+int ser_fd_poll (struct ser_port *ser, short events, int timeout_ms);
+
+int ser_low_latency (struct ser_port *ser);
+void ser_restore_latency (struct ser_port *ser);
+
+void ser_batch (struct ser_port *ser);
+int ser_apply (struct ser_port *ser);
+int ser_set_baud (struct ser_port *ser, int baud);
+int ser_set_stopbits (struct ser_port *ser, int stop_bit);
+int ser_set_parity (struct ser_port *ser, char parity);
 
-int ser_set_baud (int ser, int baud);
-int ser_set_stopbits (int ser, int stop_bit);
-int ser_set_parity (int ser, char parity);
+void ser_set_dtr (struct ser_port *ser, int i);
+void ser_set_rts (struct ser_port *ser, int i);
 
-void ser_set_dtr (int ser, int i);
-void ser_set_rts (int ser, int i);
+int ser_get_dcd (struct ser_port *ser);
+int ser_get_ri (struct ser_port *ser);
+int ser_get_dsr (struct ser_port *ser);
+int ser_get_cts (struct ser_port *ser);
 
-int ser_get_dcd (int ser);
-int ser_get_ri (int ser);
-int ser_get_dsr (int ser);
-int ser_get_cts (int ser);
+long long ser_now_ms (void);
+ssize_t ser_read (struct ser_port *ser, void *buf, size_t len);
+ssize_t ser_writev (struct ser_port *ser, const struct iovec *iov, int cnt);
+int ser_poll_ms (struct ser_port *ser, short events, int timeout_ms);
+int ser_read_exact (struct ser_port *ser, void *buf, size_t len, int deadline_ms);
+int ser_write_all (struct ser_port *ser, const void *buf, size_t len, int deadline_ms);
+int ser_writev_all (struct ser_port *ser, struct iovec *iov, int cnt, int deadline_ms);
 
-int ser_flush (int ser);
-int ser_wait (int ser, const char *cmd);
-int ser_getwait (int ser, const char *cmd, char *p);
+int ser_drain (struct ser_port *ser, const char *pattern, int idle_ms, int deadline_ms);
+int ser_flush (struct ser_port *ser);
+int ser_wait (struct ser_port *ser, const char *cmd);
+int ser_wait_ms (struct ser_port *ser, const char *cmd, int idle_ms);
+int ser_getwait (struct ser_port *ser, const char *cmd, char *p);
+int ser_expect (struct ser_port *ser, const struct match_set *m, char *line, size_t size);
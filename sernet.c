@@ -0,0 +1,479 @@
+/********************************************************************
+ *
+ * sernet.c -- serial ports over TCP (raw and RFC 2217)
+ *
+ * Copyright (C) 2021 SCS GmbH & Co. KG, Hanau, Germany
+ * written by Peter Mack (peter.mack@scs-ptc.com)
+ *
+ * MIT License
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ *
+ ********************************************************************/
+
+
+/********************************************************************
+ * Include files
+ ********************************************************************/
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <poll.h>
+#include <syslog.h>
+#include <netdb.h>
+#include <sys/socket.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+
+#include "sernet.h"
+
+
+/********************************************************************
+ * Receive states of the Telnet parser
+ ********************************************************************/
+enum telnet_state {
+	TS_DATA,
+	TS_IAC,			// after IAC
+	TS_OPT,			// after IAC WILL/WONT/DO/DONT
+	TS_SB,			// in a subnegotiation
+	TS_SB_IAC		// IAC in a subnegotiation
+};
+
+
+/********************************************************************
+ * Connect to host:port, [v6addr]:port works too
+ *
+ *  Return socket
+ *         -1 = Error
+ ********************************************************************/
+static int sernet_connect (const char *addr)
+{
+	struct addrinfo hints, *res, *ai;
+	char host[SER_NAME_MAX];
+	const char *port;
+	struct pollfd pfd;
+	socklen_t len;
+	int fd = -1;
+	int one = 1;
+	int err;
+
+	port = strrchr (addr, ':');
+	if (NULL == port || port == addr)
+	{
+		fprintf (stderr, "ERROR: %s is not host:port\n", addr);
+		return -1;
+	}
+	snprintf (host, sizeof (host), "%.*s", (int) (port - addr), addr);
+	port++;
+
+	// strip the brackets of an IPv6 address
+	if (host[0] == '[' && host[strlen (host) - 1] == ']')
+	{
+		host[strlen (host) - 1] = '\0';
+		memmove (host, host + 1, strlen (host));
+	}
+
+	memset (&hints, 0, sizeof (hints));
+	hints.ai_family = AF_UNSPEC;
+	hints.ai_socktype = SOCK_STREAM;
+
+	err = getaddrinfo (host, port, &hints, &res);
+	if (err)
+	{
+		syslog (LOG_MAKEPRI(LOG_USER, LOG_ERR), "ERROR: %s - %s", addr, gai_strerror (err));
+		fprintf (stderr, "ERROR: %s - %s\n", addr, gai_strerror (err));
+		return -1;
+	}
+
+	for (ai = res; ai; ai = ai->ai_next)
+	{
+		fd = socket (ai->ai_family, ai->ai_socktype | SOCK_NONBLOCK | SOCK_CLOEXEC, ai->ai_protocol);
+		if (fd < 0)
+		{
+			continue;
+		}
+
+		// connect with a time limit
+		if (connect (fd, ai->ai_addr, ai->ai_addrlen) && EINPROGRESS == errno)
+		{
+			pfd.fd = fd;
+			pfd.events = POLLOUT;
+			err = ETIMEDOUT;
+			len = sizeof (err);
+			if (poll (&pfd, 1, SERNET_CONNECT_MS) > 0)
+			{
+				getsockopt (fd, SOL_SOCKET, SO_ERROR, &err, &len);
+			}
+			errno = err;
+		}
+		else
+		{
+			err = 0;
+		}
+
+		if (0 == err)
+		{
+			break;
+		}
+
+		close (fd);
+		fd = -1;
+	}
+	freeaddrinfo (res);
+
+	if (fd < 0)
+	{
+		syslog (LOG_MAKEPRI(LOG_USER, LOG_ERR), "ERROR: could not connect to %s: %s", addr, strerror (errno));
+		fprintf (stderr, "ERROR: could not connect to %s: %s\n", addr, strerror (errno));
+		return -1;
+	}
+
+	// blocking like a tty, every chunk and ACK goes out at once
+	fcntl (fd, F_SETFL, fcntl (fd, F_GETFL) & ~O_NONBLOCK);
+	setsockopt (fd, IPPROTO_TCP, TCP_NODELAY, &one, sizeof (one));
+	setsockopt (fd, SOL_SOCKET, SO_KEEPALIVE, &one, sizeof (one));
+
+	return fd;
+}
+
+/********************************************************************
+ * Write everything, waiting for room if needed
+ *  for the small Telnet commands and escaped data
+ ********************************************************************/
+static int sernet_write_all (int fd, const uint8_t *p, size_t len)
+{
+	struct pollfd pfd;
+	ssize_t n;
+
+	pfd.fd = fd;
+	pfd.events = POLLOUT;
+
+	while (len)
+	{
+		n = write (fd, p, len);
+		if (n < 0)
+		{
+			if (EINTR == errno)
+			{
+				continue;
+			}
+			if (EAGAIN == errno && poll (&pfd, 1, SER_TIMEOUT_MS) > 0)
+			{
+				continue;
+			}
+			return -1;
+		}
+		p += n;
+		len -= n;
+	}
+
+	return 0;
+}
+
+static void sernet_close (struct ser_port *ser)
+{
+	close (ser->fd);
+}
+
+
+/********************************************************************
+ * Raw TCP backend
+ *  the terminal server has a fixed speed, set up on the server,
+ *  so there is no baudrate to pass
+ ********************************************************************/
+static const struct ser_ops sernet_tcp_ops = {
+	"tcp",
+	ser_fd_read,
+	ser_fd_writev,
+	ser_fd_poll,
+	NULL,
+	sernet_close
+};
+
+struct ser_port *ser_tcp_open (const char *addr)
+{
+	struct ser_port *ser;
+	int fd;
+
+	fd = sernet_connect (addr);
+	if (fd < 0)
+	{
+		return NULL;
+	}
+
+	ser = calloc (1, sizeof (struct ser_port));
+	if (NULL == ser)
+	{
+		close (fd);
+		return NULL;
+	}
+	ser->ops = &sernet_tcp_ops;
+	ser->fd = fd;
+	ser->idle_ms = SERNET_IDLE_MS;
+
+	return ser;
+}
+
+
+/********************************************************************
+ * RFC 2217 backend
+ ********************************************************************/
+
+/********************************************************************
+ * Send a COM port subnegotiation with a value of len byte
+ ********************************************************************/
+static int rfc2217_comport (struct ser_port *ser, uint8_t cmd, uint32_t value, int len)
+{
+	uint8_t buf[16];
+	int n = 0;
+	int i;
+
+	buf[n++] = TELNET_IAC;
+	buf[n++] = TELNET_SB;
+	buf[n++] = TELOPT_COMPORT;
+	buf[n++] = cmd;
+	for (i = len - 1; i >= 0; i--)
+	{
+		buf[n] = value >> (8 * i);
+		if (TELNET_IAC == buf[n++])
+		{
+			buf[n++] = TELNET_IAC;
+		}
+	}
+	buf[n++] = TELNET_IAC;
+	buf[n++] = TELNET_SE;
+
+	return sernet_write_all (ser->fd, buf, n);
+}
+
+/********************************************************************
+ * Answer an option request of the server
+ *  we want binary mode, no go ahead and COM port control,
+ *  everything else is refused
+ ********************************************************************/
+static void rfc2217_option (struct ser_port *ser, uint8_t cmd, uint8_t opt)
+{
+	uint8_t buf[3];
+
+	if (TELOPT_BINARY == opt || TELOPT_SGA == opt || TELOPT_COMPORT == opt)
+	{
+		return;		// already asked for in ser_rfc2217_open()
+	}
+
+	if (TELNET_DO == cmd || TELNET_WILL == cmd)
+	{
+		buf[0] = TELNET_IAC;
+		buf[1] = (TELNET_DO == cmd) ? TELNET_WONT : TELNET_DONT;
+		buf[2] = opt;
+		sernet_write_all (ser->fd, buf, 3);
+	}
+}
+
+/********************************************************************
+ * Read and remove the Telnet commands from the data
+ *  Return number of data bytes
+ *         0 = connection closed
+ *        -1 = Error, EAGAIN if only commands arrived
+ ********************************************************************/
+static ssize_t rfc2217_read (struct ser_port *ser, void *buf, size_t len)
+{
+	uint8_t *p = buf;
+	ssize_t n, i;
+	size_t out = 0;
+	uint8_t c;
+
+	n = read (ser->fd, buf, len);
+	if (n <= 0)
+	{
+		return n;
+	}
+
+	for (i = 0; i < n; i++)
+	{
+		c = p[i];
+
+		switch (ser->telnet)
+		{
+			case TS_DATA:
+				if (TELNET_IAC == c)
+				{
+					ser->telnet = TS_IAC;
+				}
+				else
+				{
+					p[out++] = c;
+				}
+				break;
+
+			case TS_IAC:
+				ser->telnet = TS_DATA;
+				if (TELNET_IAC == c)
+				{
+					p[out++] = c;	// escaped 0xFF
+				}
+				else if (c >= TELNET_WILL)
+				{
+					ser->telnet_cmd = c;
+					ser->telnet = TS_OPT;
+				}
+				else if (TELNET_SB == c)
+				{
+					ser->telnet = TS_SB;
+				}
+				break;
+
+			case TS_OPT:
+				rfc2217_option (ser, ser->telnet_cmd, c);
+				ser->telnet = TS_DATA;
+				break;
+
+			case TS_SB:
+				// the answers to our COM port settings are not needed
+				if (TELNET_IAC == c)
+				{
+					ser->telnet = TS_SB_IAC;
+				}
+				break;
+
+			case TS_SB_IAC:
+				ser->telnet = (TELNET_SE == c) ? TS_DATA : TS_SB;
+				break;
+		}
+	}
+
+	if (0 == out)
+	{
+		errno = EAGAIN;
+		return -1;
+	}
+
+	return out;
+}
+
+/********************************************************************
+ * Write with 0xFF doubled
+ *  data without 0xFF goes out with one writev(), the rest is
+ *  escaped into one buffer and written completely
+ ********************************************************************/
+static ssize_t rfc2217_writev (struct ser_port *ser, const struct iovec *iov, int cnt)
+{
+	uint8_t *buf, *q;
+	const uint8_t *p;
+	size_t total = 0;
+	size_t esc = 0;
+	size_t j;
+	int i;
+	int r;
+
+	for (i = 0; i < cnt; i++)
+	{
+		p = iov[i].iov_base;
+		total += iov[i].iov_len;
+		for (j = 0; j < iov[i].iov_len; j++)
+		{
+			esc += (TELNET_IAC == p[j]);
+		}
+	}
+
+	if (0 == esc)
+	{
+		return writev (ser->fd, iov, cnt);
+	}
+
+	buf = malloc (total + esc);
+	if (NULL == buf)
+	{
+		return -1;
+	}
+
+	q = buf;
+	for (i = 0; i < cnt; i++)
+	{
+		p = iov[i].iov_base;
+		for (j = 0; j < iov[i].iov_len; j++)
+		{
+			*q++ = p[j];
+			if (TELNET_IAC == p[j])
+			{
+				*q++ = TELNET_IAC;
+			}
+		}
+	}
+
+	r = sernet_write_all (ser->fd, buf, total + esc);
+	free (buf);
+
+	return r ? -1 : (ssize_t) total;
+}
+
+/********************************************************************
+ * Set the speed of the remote port
+ ********************************************************************/
+static int rfc2217_set_speed (struct ser_port *ser, int baud)
+{
+	return rfc2217_comport (ser, COMPORT_SET_BAUDRATE, baud, 4);
+}
+
+static const struct ser_ops sernet_rfc2217_ops = {
+	"rfc2217",
+	rfc2217_read,
+	rfc2217_writev,
+	ser_fd_poll,
+	rfc2217_set_speed,
+	sernet_close
+};
+
+struct ser_port *ser_rfc2217_open (const char *addr, int baud)
+{
+	static const uint8_t nego[] = {
+		TELNET_IAC, TELNET_WILL, TELOPT_COMPORT,
+		TELNET_IAC, TELNET_WILL, TELOPT_BINARY,
+		TELNET_IAC, TELNET_DO, TELOPT_BINARY,
+		TELNET_IAC, TELNET_WILL, TELOPT_SGA,
+		TELNET_IAC, TELNET_DO, TELOPT_SGA
+	};
+	struct ser_port *ser;
+
+	ser = ser_tcp_open (addr);
+	if (NULL == ser)
+	{
+		return NULL;
+	}
+	ser->ops = &sernet_rfc2217_ops;
+	ser->telnet = TS_DATA;
+
+	// 8N1, no flow control, like ser_open() sets up a tty
+	if (sernet_write_all (ser->fd, nego, sizeof (nego)) ||
+		rfc2217_comport (ser, COMPORT_SET_BAUDRATE, baud, 4) ||
+		rfc2217_comport (ser, COMPORT_SET_DATASIZE, 8, 1) ||
+		rfc2217_comport (ser, COMPORT_SET_PARITY, 1, 1) ||
+		rfc2217_comport (ser, COMPORT_SET_STOPSIZE, 1, 1) ||
+		rfc2217_comport (ser, COMPORT_SET_CONTROL, 1, 1))
+	{
+		syslog (LOG_MAKEPRI(LOG_USER, LOG_ERR), "ERROR: RFC 2217 setup of %s failed", addr);
+		sernet_close (ser);
+		free (ser);
+		return NULL;
+	}
+
+	return ser;
+}
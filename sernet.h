@@ -0,0 +1,68 @@
+/********************************************************************
+ *
+ * sernet.h -- serial ports over TCP (raw and RFC 2217)
+ *
+ * Copyright (C) 2021 SCS GmbH & Co. KG, Hanau, Germany
+ * written by Peter Mack (peter.mack@scs-ptc.com)
+ *
+ * MIT License
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ *
+ ********************************************************************/
+
+#pragma once
+
+/********************************************************************
+ * Include files
+ ********************************************************************/
+#include "serial.h"
+
+
+/********************************************************************
+ * Defines
+ ********************************************************************/
+#define SERNET_CONNECT_MS	5000	// max. time to connect
+#define SERNET_IDLE_MS		100		// terminal servers pack bytes and add delay
+
+// Telnet (RFC 854) and COM port control (RFC 2217)
+#define TELNET_IAC		255
+#define TELNET_DONT		254
+#define TELNET_DO		253
+#define TELNET_WONT		252
+#define TELNET_WILL		251
+#define TELNET_SB		250
+#define TELNET_SE		240
+
+#define TELOPT_BINARY	0
+#define TELOPT_SGA		3
+#define TELOPT_COMPORT	44
+
+#define COMPORT_SET_BAUDRATE	1
+#define COMPORT_SET_DATASIZE	2
+#define COMPORT_SET_PARITY		3
+#define COMPORT_SET_STOPSIZE	4
+#define COMPORT_SET_CONTROL		5
+
+
+/********************************************************************
+ * Function prototypes
+ ********************************************************************/
+struct ser_port *ser_tcp_open (const char *addr);
+struct ser_port *ser_rfc2217_open (const char *addr, int baud);
@@ -0,0 +1,592 @@
+/********************************************************************
+ *
+ * scsupdate-sim.c -- SCS modem simulator on a pseudo terminal
+ *
+ * Copyright (C) 2021 SCS GmbH & Co. KG, Hanau, Germany
+ * written by Peter Mack (peter.mack@scs-ptc.com)
+ *
+ * MIT License
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ *
+ ********************************************************************/
+
+
+#define _GNU_SOURCE
+
+/********************************************************************
+ * Include files
+ ********************************************************************/
+#include <stdio.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <stdbool.h>
+#include <string.h>
+#include <strings.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <poll.h>
+#include <time.h>
+#include <getopt.h>
+#include <termios.h>
+
+#include "update.h"
+
+
+/********************************************************************
+ * Defines
+ ********************************************************************/
+#define SIM_TIMEOUT_MS	15000	// host silent this long = update aborted
+#define SIM_LINGER_MS	2000	// wait for the ESC of the host after a failed update
+#define SIM_NAK			'\025'
+#define SIM_SERNUM		0x0123456789ABCDEFULL
+#define SIM_STAMP		0x52000000		// FDTIME 2021-01-00 00:00
+#ifndef VERSION
+#define VERSION "x.x"
+#endif
+
+
+/********************************************************************
+ * Types
+ ********************************************************************/
+struct sim {
+	int master;
+	int slave;				// kept open, the master never sees a hang up
+	char type;				// modem type letter for ver ##
+	uint64_t sernum;
+	int ptc;				// PACTOR channel
+	uint16_t flashid;
+	uint32_t stamp;			// FDTIME, raw
+	int baud;				// pacing, 0 = as fast as possible
+	int ack_us;				// extra time before every ACK
+	int erase_every;		// flash erase stall every n chunks, 0 = never
+	int erase_ms;
+	long drop;				// chunk that loses a byte, -1 = none
+	long nak;				// chunk that gets a NAK
+	long garbage;			// chunk that gets noise instead of an ACK
+	const char *reject;		// commands with this prefix get an error reply
+	const char *output;		// received image
+	bool once;				// exit after the first update
+	// receive buffer
+	uint8_t rx[4096];
+	size_t rxlen;
+	size_t rxpos;
+};
+
+
+/********************************************************************
+ * Monotonic clock in us
+ ********************************************************************/
+static long long sim_now_us (void)
+{
+	struct timespec ts;
+
+	clock_gettime (CLOCK_MONOTONIC, &ts);
+
+	return (long long) ts.tv_sec * 1000000 + ts.tv_nsec / 1000;
+}
+
+/********************************************************************
+ * Sleep until an absolute time (us)
+ ********************************************************************/
+static void sim_sleep_until (long long t)
+{
+	long long left = t - sim_now_us ();
+	struct timespec ts;
+
+	if (left <= 0)
+	{
+		return;
+	}
+
+	ts.tv_sec = left / 1000000;
+	ts.tv_nsec = (left % 1000000) * 1000;
+	while (nanosleep (&ts, &ts) && EINTR == errno)
+	{
+	}
+}
+
+/********************************************************************
+ * Time on the wire for n bytes (us), 10 bits per byte
+ ********************************************************************/
+static long long sim_wire_us (const struct sim *sim, size_t n)
+{
+	return sim->baud ? (long long) n * 10000000LL / sim->baud : 0;
+}
+
+/********************************************************************
+ * Send to the host, paced to the baud rate
+ ********************************************************************/
+static void sim_write (struct sim *sim, const void *buf, size_t len)
+{
+	const uint8_t *p = buf;
+	ssize_t n;
+
+	sim_sleep_until (sim_now_us () + sim_wire_us (sim, len));
+
+	while (len)
+	{
+		n = write (sim->master, p, len);
+		if (n < 0)
+		{
+			if (EINTR == errno || EAGAIN == errno)
+			{
+				continue;
+			}
+			perror ("write");
+			return;
+		}
+		p += n;
+		len -= n;
+	}
+}
+
+static void sim_puts (struct sim *sim, const char *s)
+{
+	sim_write (sim, s, strlen (s));
+}
+
+/********************************************************************
+ * Next byte from the host
+ *  Return byte
+ *         -1 = nothing within timeout_ms
+ ********************************************************************/
+static int sim_getc (struct sim *sim, int timeout_ms)
+{
+	struct pollfd pfd;
+	ssize_t n;
+
+	while (sim->rxpos == sim->rxlen)
+	{
+		pfd.fd = sim->master;
+		pfd.events = POLLIN;
+		if (poll (&pfd, 1, timeout_ms) <= 0)
+		{
+			return -1;
+		}
+
+		n = read (sim->master, sim->rx, sizeof (sim->rx));
+		if (n < 0 && (EINTR == errno || EAGAIN == errno))
+		{
+			continue;
+		}
+		if (n <= 0)
+		{
+			return -1;
+		}
+		sim->rxlen = n;
+		sim->rxpos = 0;
+	}
+
+	return sim->rx[sim->rxpos++];
+}
+
+/********************************************************************
+ * Write the received image
+ ********************************************************************/
+static void sim_save (const struct sim *sim, const uint8_t *data, size_t len)
+{
+	FILE *f;
+
+	if (NULL == sim->output)
+	{
+		return;
+	}
+
+	f = fopen (sim->output, "wb");
+	if (NULL == f || fwrite (data, 1, len, f) != len)
+	{
+		perror (sim->output);
+	}
+	if (f)
+	{
+		fclose (f);
+	}
+}
+
+/********************************************************************
+ * The update protocol, modem side
+ *  Return 0 = image received
+ *        -1 = aborted
+ ********************************************************************/
+static int sim_update (struct sim *sim)
+{
+	uint8_t id[6];
+	uint8_t *data;
+	unsigned chunks, i, j;
+	long long first, ack;
+	int c;
+
+	sim_puts (sim, "*** Flash update, waiting for ACK\r\n");
+
+	do
+	{
+		c = sim_getc (sim, SIM_TIMEOUT_MS);
+	}
+	while (c >= 0 && c != ACK && c != ESC);
+	if (c != ACK)
+	{
+		fprintf (stderr, "sim: no ACK after the banner\n");
+		return -1;
+	}
+
+	id[0] = sim->flashid;
+	id[1] = sim->flashid >> 8;
+	id[2] = sim->stamp;
+	id[3] = sim->stamp >> 8;
+	id[4] = sim->stamp >> 16;
+	id[5] = sim->stamp >> 24;
+	sim_write (sim, id, sizeof (id));
+
+	c = sim_getc (sim, SIM_TIMEOUT_MS);
+	if (c != ACK)
+	{
+		fprintf (stderr, "sim: update canceled by the host (%02X)\n", c & 0xff);
+		return -1;
+	}
+	c = sim_getc (sim, SIM_TIMEOUT_MS);
+	chunks = sim_getc (sim, SIM_TIMEOUT_MS);
+	if (c < 0 || chunks > 0xffff)
+	{
+		fprintf (stderr, "sim: no chunk count\n");
+		return -1;
+	}
+	chunks |= c << 8;
+	sim_write (sim, "\006", 1);
+
+	fprintf (stderr, "sim: receiving %u chunks\n", chunks);
+
+	data = malloc ((size_t) chunks * CHUNKSIZE + 1);
+	if (NULL == data)
+	{
+		return -1;
+	}
+
+	for (i = 0; i < chunks; i++)
+	{
+		first = 0;
+		for (j = 0; j < CHUNKSIZE; )
+		{
+			c = sim_getc (sim, SIM_TIMEOUT_MS);
+			if (c < 0)
+			{
+				fprintf (stderr, "sim: host stopped in chunk %u at byte %u\n", i, j);
+				free (data);
+				return -1;
+			}
+			if (0 == first)
+			{
+				first = sim_now_us ();
+			}
+			if (i == sim->drop)
+			{
+				sim->drop = -1;		// this byte gets lost on the line
+				continue;
+			}
+			data[(size_t) i * CHUNKSIZE + j++] = c;
+		}
+
+		// the ACK comes when the chunk could have arrived and the flash is written
+		ack = first + sim_wire_us (sim, CHUNKSIZE) + sim->ack_us;
+		if (sim->erase_every && 0 == i % sim->erase_every)
+		{
+			ack += sim->erase_ms * 1000LL;
+		}
+		sim_sleep_until (ack);
+
+		if (i == sim->nak)
+		{
+			fprintf (stderr, "sim: NAK for chunk %u\n", i);
+			sim_write (sim, "\025", 1);
+			free (data);
+			return -1;
+		}
+		if (i == sim->garbage)
+		{
+			fprintf (stderr, "sim: noise for chunk %u\n", i);
+			sim_write (sim, "\000\377\023", 3);
+			free (data);
+			return -1;
+		}
+
+		sim_write (sim, "\006", 1);
+	}
+
+	// the host ends with a CR
+	if (sim_getc (sim, SIM_TIMEOUT_MS) != '\r')
+	{
+		fprintf (stderr, "sim: no CR after the last chunk\n");
+	}
+
+	sim_save (sim, data, (size_t) chunks * CHUNKSIZE);
+	free (data);
+
+	fprintf (stderr, "sim: update complete, %u chunks\n", chunks);
+
+	return 0;
+}
+
+/********************************************************************
+ * Let the host read the end of a failed update before --once exits
+ *  closing the master hangs up the terminal and throws away what
+ *  the host has not read yet, the host answers a NAK with ESC
+ ********************************************************************/
+static void sim_linger (struct sim *sim)
+{
+	long long end = sim_now_us () + SIM_LINGER_MS * 1000LL;
+	long long left;
+	int c;
+
+	tcdrain (sim->master);
+
+	while ((left = end - sim_now_us ()) > 0)
+	{
+		c = sim_getc (sim, left / 1000 + 1);
+		if (c < 0 || c == ESC)
+		{
+			break;
+		}
+	}
+}
+
+/********************************************************************
+ * Answer one command line
+ *  Return 1 = go on
+ *         0 = update done and --once
+ *        -1 = update failed and --once
+ ********************************************************************/
+static int sim_command (struct sim *sim, const char *line)
+{
+	char buf[128];
+	int r;
+
+	sim_puts (sim, line);
+	sim_puts (sim, "\r\n");
+
+	if (sim->reject && *line && !strncmp (line, sim->reject, strlen (sim->reject)))
+	{
+		sim_puts (sim, "*** Unknown command\r\n");
+	}
+	else if (!strcmp (line, "ver ##"))
+	{
+		snprintf (buf, sizeof (buf), "#0:%c\r\n#1:SIM " VERSION "\r\n", sim->type);
+		sim_puts (sim, buf);
+	}
+	else if (!strcmp (line, "sys sern"))
+	{
+		snprintf (buf, sizeof (buf), "Serial number: %016llX\r\n", (unsigned long long) sim->sernum);
+		sim_puts (sim, buf);
+	}
+	else if (!strcmp (line, "ptc"))
+	{
+		snprintf (buf, sizeof (buf), "*** PACTOR channel: %d\r\n", sim->ptc);
+		sim_puts (sim, buf);
+	}
+	else if (!strncasecmp (line, "serb ", 5))
+	{
+		// confirm at the old speed, then switch
+		sim_puts (sim, CMDSTR);
+		if (sim->baud)
+		{
+			sim->baud = strtol (line + 5, NULL, 10);
+		}
+		return 1;
+	}
+	else if (!strcmp (line, UPDATE_BANNER))
+	{
+		r = sim_update (sim);
+		if (sim->once)
+		{
+			if (r < 0)
+			{
+				sim_linger (sim);
+			}
+			return r;
+		}
+	}
+
+	sim_puts (sim, CMDSTR);
+
+	return 1;
+}
+
+/********************************************************************
+ * Usage
+ ********************************************************************/
+static void usage (void)
+{
+	fprintf (stderr, "\nUsage:\n");
+	fprintf (stderr, "  scsupdate-sim [options]\n");
+	fprintf (stderr, "    emulates an SCS modem on a pseudo terminal, the name of\n");
+	fprintf (stderr, "    the terminal is the first line on stdout\n\n");
+	fprintf (stderr, "Options:\n");
+	fprintf (stderr, "  --type=<c>          modem type for ver ## (A..T as in ptc.c, default H)\n");
+	fprintf (stderr, "  --serial=<hex>      serial number\n");
+	fprintf (stderr, "  --flash-id=<hex>    flash ID (a41f, 5b1f or da1f, default a41f)\n");
+	fprintf (stderr, "  --stamp=<hex>       FDTIME stamp of the installed firmware\n");
+	fprintf (stderr, "  --baud=<n>          pace like a serial line with n baud (default off)\n");
+	fprintf (stderr, "  --ack-delay=<us>    extra delay before every ACK\n");
+	fprintf (stderr, "  --erase-every=<n>   flash erase stall every n chunks\n");
+	fprintf (stderr, "  --erase-ms=<ms>     length of the erase stall\n");
+	fprintf (stderr, "  --drop=<chunk>      lose the first byte of this chunk\n");
+	fprintf (stderr, "  --nak=<chunk>       answer this chunk with NAK\n");
+	fprintf (stderr, "  --garbage=<chunk>   answer this chunk with noise\n");
+	fprintf (stderr, "  --reject=<prefix>   answer commands starting with prefix with an error\n");
+	fprintf (stderr, "  --output=<file>     write the received image to file\n");
+	fprintf (stderr, "  --link=<path>       symlink to the pseudo terminal\n");
+	fprintf (stderr, "  --once              exit after the first update\n\n");
+	exit (1);
+}
+
+/********************************************************************
+ * Main function
+ ********************************************************************/
+int main (int argc, char *argv[])
+{
+	struct sim sim = {
+		.type = 'H',
+		.sernum = SIM_SERNUM,
+		.ptc = 31,
+		.flashid = 0xa41f,
+		.stamp = SIM_STAMP,
+		.drop = -1,
+		.nak = -1,
+		.garbage = -1
+	};
+	const char *link = NULL;
+	struct termios tio;
+	char line[256];
+	size_t len = 0;
+	int ret = 0;
+	int opt;
+	int c;
+
+	static const struct option options[] = {
+		{"type",		required_argument,	NULL, 't'},
+		{"serial",		required_argument,	NULL, 's'},
+		{"flash-id",	required_argument,	NULL, 'f'},
+		{"stamp",		required_argument,	NULL, 'S'},
+		{"baud",		required_argument,	NULL, 'b'},
+		{"ack-delay",	required_argument,	NULL, 'a'},
+		{"erase-every",	required_argument,	NULL, 'e'},
+		{"erase-ms",	required_argument,	NULL, 'E'},
+		{"drop",		required_argument,	NULL, 'd'},
+		{"nak",			required_argument,	NULL, 'n'},
+		{"garbage",		required_argument,	NULL, 'g'},
+		{"reject",		required_argument,	NULL, 'r'},
+		{"output",		required_argument,	NULL, 'o'},
+		{"link",		required_argument,	NULL, 'l'},
+		{"once",		no_argument,		NULL, '1'},
+		{"help",		no_argument,		NULL, 'h'},
+		{NULL, 0, NULL, 0}
+	};
+
+	while ((opt = getopt_long (argc, argv, "h", options, NULL)) != -1)
+	{
+		switch (opt)
+		{
+			case 't': sim.type = optarg[0]; break;
+			case 's': sim.sernum = strtoull (optarg, NULL, 16); break;
+			case 'f': sim.flashid = strtoul (optarg, NULL, 16); break;
+			case 'S': sim.stamp = strtoul (optarg, NULL, 16); break;
+			case 'b': sim.baud = strtol (optarg, NULL, 10); break;
+			case 'a': sim.ack_us = strtol (optarg, NULL, 10); break;
+			case 'e': sim.erase_every = strtol (optarg, NULL, 10); break;
+			case 'E': sim.erase_ms = strtol (optarg, NULL, 10); break;
+			case 'd': sim.drop = strtol (optarg, NULL, 10); break;
+			case 'n': sim.nak = strtol (optarg, NULL, 10); break;
+			case 'g': sim.garbage = strtol (optarg, NULL, 10); break;
+			case 'r': sim.reject = optarg; break;
+			case 'o': sim.output = optarg; break;
+			case 'l': link = optarg; break;
+			case '1': sim.once = true; break;
+			default: usage ();
+		}
+	}
+
+	sim.master = posix_openpt (O_RDWR | O_NOCTTY);
+	if (sim.master < 0 || grantpt (sim.master) || unlockpt (sim.master))
+	{
+		perror ("posix_openpt");
+		return 1;
+	}
+
+	sim.slave = open (ptsname (sim.master), O_RDWR | O_NOCTTY);
+	if (sim.slave < 0)
+	{
+		perror (ptsname (sim.master));
+		return 1;
+	}
+
+	// raw until the host opens it, no echo from the line discipline
+	tcgetattr (sim.slave, &tio);
+	cfmakeraw (&tio);
+	tcsetattr (sim.slave, TCSANOW, &tio);
+
+	if (link)
+	{
+		unlink (link);
+		if (symlink (ptsname (sim.master), link))
+		{
+			perror (link);
+		}
+	}
+
+	printf ("%s\n", ptsname (sim.master));
+	fflush (stdout);
+
+	for (;;)
+	{
+		c = sim_getc (&sim, -1);
+		if (c < 0)
+		{
+			break;
+		}
+
+		if (c == '\n')
+		{
+			continue;
+		}
+		if (c != '\r')
+		{
+			if (len < sizeof (line) - 1)
+			{
+				line[len++] = c;
+			}
+			continue;
+		}
+
+		line[len] = '\0';
+		len = 0;
+
+		ret = sim_command (&sim, line);
+		if (ret <= 0)
+		{
+			break;
+		}
+	}
+
+	if (link)
+	{
+		unlink (link);
+	}
+
+	return ret < 0 ? 1 : 0;
+}
@@ -0,0 +1,305 @@
+/********************************************************************
+ *
+ * timing.c -- phase timing, latency histogram and trace export
+ *
+ * Copyright (C) 2021 SCS GmbH & Co. KG, Hanau, Germany
+ * written by Peter Mack (peter.mack@scs-ptc.com)
+ *
+ * MIT License
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ *
+ ********************************************************************/
+
+/********************************************************************
+ * Include files
+ ********************************************************************/
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include "timing.h"
+
+
+/********************************************************************
+ * Global variables
+ ********************************************************************/
+static const char *phase_names[PHASE_MAX] = {
+	"discovery",
+	"open",
+	"identify",
+	"firmware_check",
+	"handshake",
+	"transfer"
+};
+
+
+/********************************************************************
+ * Monotonic clock in ns
+ ********************************************************************/
+long long timing_now_ns (void)
+{
+	struct timespec ts;
+
+	clock_gettime (CLOCK_MONOTONIC, &ts);
+
+	return (long long) ts.tv_sec * 1000000000LL + ts.tv_nsec;
+}
+
+
+/********************************************************************
+ * Histogram bucket of a value
+ *  values below HIST_SUB_COUNT get their own bucket, above that
+ *  every power of two is split into HIST_SUB_COUNT linear buckets
+ ********************************************************************/
+static int hist_index (uint64_t v)
+{
+	int msb;
+	int shift;
+
+	if (v < HIST_SUB_COUNT)
+	{
+		return v;
+	}
+
+	msb = 63 - __builtin_clzll (v);
+	shift = msb - HIST_SUB_BITS;
+
+	return (shift + 1) * HIST_SUB_COUNT + ((v >> shift) & (HIST_SUB_COUNT - 1));
+}
+
+/********************************************************************
+ * Highest value that falls into a bucket
+ ********************************************************************/
+static uint64_t hist_value (int idx)
+{
+	int shift;
+
+	if (idx < HIST_SUB_COUNT)
+	{
+		return idx;
+	}
+
+	shift = idx / HIST_SUB_COUNT - 1;
+
+	return ((uint64_t) (HIST_SUB_COUNT + idx % HIST_SUB_COUNT) << shift) + ((uint64_t) 1 << shift) - 1;
+}
+
+/********************************************************************
+ * Record a value
+ ********************************************************************/
+void hist_add (struct histogram *h, uint64_t v)
+{
+	h->count[hist_index (v)]++;
+
+	if (0 == h->total || v < h->min)
+	{
+		h->min = v;
+	}
+	if (v > h->max)
+	{
+		h->max = v;
+	}
+	h->total++;
+	h->sum += v;
+}
+
+/********************************************************************
+ * Value below which p percent of the recorded values are
+ ********************************************************************/
+uint64_t hist_percentile (const struct histogram *h, double p)
+{
+	uint64_t rank;
+	uint64_t seen = 0;
+	int i;
+
+	if (0 == h->total)
+	{
+		return 0;
+	}
+
+	rank = (uint64_t) (p / 100.0 * h->total + 0.5);
+	if (rank < 1)
+	{
+		rank = 1;
+	}
+
+	for (i = 0; i < HIST_BUCKETS; i++)
+	{
+		seen += h->count[i];
+		if (seen >= rank)
+		{
+			return hist_value (i) < h->max ? hist_value (i) : h->max;
+		}
+	}
+
+	return h->max;
+}
+
+
+/********************************************************************
+ * Start a timing record
+ ********************************************************************/
+void timing_init (struct timing *tm)
+{
+	memset (tm, 0, sizeof (*tm));
+	tm->origin_ns = timing_now_ns ();
+}
+
+/********************************************************************
+ * Release a timing record
+ ********************************************************************/
+void timing_free (struct timing *tm)
+{
+	free (tm->chunk);
+	tm->chunk = NULL;
+	tm->chunks = 0;
+	tm->chunks_max = 0;
+}
+
+/********************************************************************
+ * Begin and end of a phase, tm may be NULL
+ ********************************************************************/
+void timing_begin (struct timing *tm, enum timing_phase phase)
+{
+	if (tm)
+	{
+		tm->phase[phase].start_ns = timing_now_ns ();
+	}
+}
+
+void timing_end (struct timing *tm, enum timing_phase phase)
+{
+	if (tm)
+	{
+		tm->phase[phase].end_ns = timing_now_ns ();
+	}
+}
+
+/********************************************************************
+ * Record one chunk from write to ACK, tm may be NULL
+ ********************************************************************/
+void timing_chunk (struct timing *tm, long long start_ns, long long end_ns, size_t bytes)
+{
+	struct timing_span *p;
+
+	if (NULL == tm)
+	{
+		return;
+	}
+
+	hist_add (&tm->ack_us, (end_ns - start_ns) / 1000);
+	tm->bytes += bytes;
+
+	if (tm->chunks == tm->chunks_max)
+	{
+		p = realloc (tm->chunk, (tm->chunks_max ? 2 * tm->chunks_max : 1024) * sizeof (*p));
+		if (NULL == p)
+		{
+			return;		// the trace misses this chunk, the histogram has it
+		}
+		tm->chunk = p;
+		tm->chunks_max = tm->chunks_max ? 2 * tm->chunks_max : 1024;
+	}
+
+	tm->chunk[tm->chunks].start_ns = start_ns;
+	tm->chunk[tm->chunks].end_ns = end_ns;
+	tm->chunks++;
+}
+
+
+/********************************************************************
+ * Write the summary and a Chrome trace event timeline as JSON
+ *  the file loads directly into chrome://tracing or Perfetto
+ * Return:
+ *  0 = Ok
+ *  negative = Error
+ ********************************************************************/
+int timing_write (const struct timing *tm, const char *filename)
+{
+	const struct timing_span *ph;
+	const struct histogram *h = &tm->ack_us;
+	const struct timing_span *tr = &tm->phase[PHASE_TRANSFER];
+	double secs;
+	const char *sep = "";
+	FILE *f;
+	size_t i;
+	int n;
+
+	f = fopen (filename, "w");
+	if (NULL == f)
+	{
+		fprintf (stderr, "ERROR: could not write %s\n", filename);
+		return -1;
+	}
+
+	fprintf (f, "{\n  \"summary\": {\n    \"phases_ms\": {");
+	for (n = 0; n < PHASE_MAX; n++)
+	{
+		ph = &tm->phase[n];
+		if (ph->start_ns && ph->end_ns)
+		{
+			fprintf (f, "%s\n      \"%s\": %.3f", sep, phase_names[n], (ph->end_ns - ph->start_ns) / 1e6);
+			sep = ",";
+		}
+	}
+	fprintf (f, "\n    },\n");
+
+	secs = (tr->start_ns && tr->end_ns) ? (tr->end_ns - tr->start_ns) / 1e9 : 0;
+	fprintf (f, "    \"chunks\": %llu,\n    \"bytes\": %llu,\n    \"bytes_per_s\": %.0f,\n",
+			 (unsigned long long) h->total, (unsigned long long) tm->bytes, secs > 0 ? tm->bytes / secs : 0);
+	fprintf (f, "    \"ack_latency_us\": {\"min\": %llu, \"mean\": %.1f, \"p50\": %llu, \"p90\": %llu, "
+			 "\"p99\": %llu, \"p99.9\": %llu, \"max\": %llu}\n  },\n",
+			 (unsigned long long) h->min, h->total ? h->sum / h->total : 0,
+			 (unsigned long long) hist_percentile (h, 50),
+			 (unsigned long long) hist_percentile (h, 90),
+			 (unsigned long long) hist_percentile (h, 99),
+			 (unsigned long long) hist_percentile (h, 99.9),
+			 (unsigned long long) h->max);
+
+	// trace events: phases on thread 1, chunks on thread 2, time in us
+	fprintf (f, "  \"displayTimeUnit\": \"ms\",\n  \"traceEvents\": [");
+	sep = "";
+	for (n = 0; n < PHASE_MAX; n++)
+	{
+		ph = &tm->phase[n];
+		if (ph->start_ns && ph->end_ns)
+		{
+			fprintf (f, "%s\n    {\"name\": \"%s\", \"cat\": \"phase\", \"ph\": \"X\", \"pid\": 1, \"tid\": 1, \"ts\": %.3f, \"dur\": %.3f}",
+					 sep, phase_names[n], (ph->start_ns - tm->origin_ns) / 1e3, (ph->end_ns - ph->start_ns) / 1e3);
+			sep = ",";
+		}
+	}
+	for (i = 0; i < tm->chunks; i++)
+	{
+		fprintf (f, "%s\n    {\"name\": \"chunk\", \"cat\": \"chunk\", \"ph\": \"X\", \"pid\": 1, \"tid\": 2, \"ts\": %.3f, \"dur\": %.3f, \"args\": {\"n\": %zu}}",
+				 sep, (tm->chunk[i].start_ns - tm->origin_ns) / 1e3, (tm->chunk[i].end_ns - tm->chunk[i].start_ns) / 1e3, i);
+		sep = ",";
+	}
+	fprintf (f, "\n  ]\n}\n");
+
+	if (fclose (f))
+	{
+		fprintf (stderr, "ERROR: could not write %s\n", filename);
+		return -1;
+	}
+
+	return 0;
+}
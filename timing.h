@@ -0,0 +1,97 @@
+/********************************************************************
+ *
+ * timing.h -- phase timing, latency histogram and trace export
+ *
+ * Copyright (C) 2021 SCS GmbH & Co. KG, Hanau, Germany
+ * written by Peter Mack (peter.mack@scs-ptc.com)
+ *
+ * MIT License
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ *
+ ********************************************************************/
+
+#pragma once
+
+/********************************************************************
+ * Include files
+ ********************************************************************/
+#include <stddef.h>
+#include <stdint.h>
+
+
+/********************************************************************
+ * Defines
+ ********************************************************************/
+#define HIST_SUB_BITS	5							// 32 sub buckets per power of two, ~3 % resolution
+#define HIST_SUB_COUNT	(1 << HIST_SUB_BITS)
+#define HIST_BUCKETS	((64 - HIST_SUB_BITS + 1) * HIST_SUB_COUNT)
+
+
+/********************************************************************
+ * Types
+ ********************************************************************/
+enum timing_phase {
+	PHASE_DISCOVERY,	// USB search
+	PHASE_OPEN,			// ser_open()
+	PHASE_IDENTIFY,		// device cache or PTC_identify()
+	PHASE_CHECK,		// firmware check
+	PHASE_HANDSHAKE,	// UPDATE up to the ACK of the chunk count
+	PHASE_TRANSFER,		// chunk loop
+	PHASE_MAX
+};
+
+struct histogram {
+	uint64_t count[HIST_BUCKETS];
+	uint64_t total;
+	uint64_t min;
+	uint64_t max;
+	double sum;
+};
+
+struct timing_span {
+	long long start_ns;
+	long long end_ns;
+};
+
+struct timing {
+	long long origin_ns;						// time stamps are relative to this
+	struct timing_span phase[PHASE_MAX];
+	struct histogram ack_us;					// write to ACK latency per chunk
+	struct timing_span *chunk;					// every chunk, for the trace
+	size_t chunks;
+	size_t chunks_max;
+	uint64_t bytes;
+};
+
+
+/********************************************************************
+ * Function prototypes
+ ********************************************************************/
+long long timing_now_ns (void);
+
+void hist_add (struct histogram *h, uint64_t v);
+uint64_t hist_percentile (const struct histogram *h, double p);
+
+void timing_init (struct timing *tm);
+void timing_free (struct timing *tm);
+void timing_begin (struct timing *tm, enum timing_phase phase);
+void timing_end (struct timing *tm, enum timing_phase phase);
+void timing_chunk (struct timing *tm, long long start_ns, long long end_ns, size_t bytes);
+int timing_write (const struct timing *tm, const char *filename);
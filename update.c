@@ -33,60 +33,212 @@
  ********************************************************************/
 #include <fcntl.h>
 #include <unistd.h>
+#include <errno.h>
+#include <poll.h>
 #include <stdio.h>
 #include <time.h>
 #include <syslog.h>
 #include <termios.h>
 #include <string.h>
+#include <sys/uio.h>
+#include <pthread.h>
 
 #include "serial.h"
+#include "match.h"
 #include "ptc.h"
 #include "dr7chk.h"
 #include "ptcchk.h"
+#include "catalog.h"
+#include "link.h"
 #include "update.h"
 
 
 /********************************************************************
- *
+ * Global variables
  ********************************************************************/
-int update (int ser, struct modemtype modem, char *UpdateFileName)
+int update_idle_ms = UPDATE_IDLE_MS;	// silence after the UPDATE banner
+
+static struct match_set banner_match;
+static pthread_once_t banner_once = PTHREAD_ONCE_INIT;
+
+
+/********************************************************************
+ * Stage chunk n of the image for sending
+ *  the chunk is sent straight from the mapped image, the last one
+ *  gets a second vector with the zero padding. Touching the data
+ *  faults the page in now, not in the writev() of the next round trip.
+ *  Return number of vectors
+ ********************************************************************/
+static int stage_chunk (const struct fw_image *img, unsigned long n, struct iovec *iov)
 {
-	char buffer[2 * CHUNKSIZE];
+	static const uint8_t zeros[CHUNKSIZE];
+	const uint8_t *p = img->data + n * CHUNKSIZE;
+	size_t left = img->size - n * CHUNKSIZE;
+	volatile uint8_t touch;
 
-#ifdef DEBUG
-	int r;
-#endif
+	iov[0].iov_base = (void *) p;
+	iov[0].iov_len = left < CHUNKSIZE ? left : CHUNKSIZE;
 
-	char ch;
-	uint16_t flashID;
-	unsigned short chunks;
-	unsigned long chunksWritten = 0;
-	unsigned long bytesRead;
+	touch = p[0];
+	touch = p[iov[0].iov_len - 1];
+	(void) touch;
+
+	if (left < CHUNKSIZE)
+	{
+		iov[1].iov_base = (void *) zeros;
+		iov[1].iov_len = CHUNKSIZE - left;
+		return 2;
+	}
+
+	return 1;
+}
 
-	int hFile;
-	unsigned long fileLength;
 
-	FDTIME fileStamp;
-	FDTIME flashStamp;
 
-	char *fext;
+/********************************************************************
+ * Queue output, session_step() sends it before the state runs
+ ********************************************************************/
+static void session_send (struct update_session *s, const void *buf, size_t len)
+{
+	s->tx[s->txcnt].iov_base = (void *) buf;
+	s->tx[s->txcnt].iov_len = len;
+	s->txcnt++;
+}
 
-	hFile = open (UpdateFileName, O_RDONLY);
+/********************************************************************
+ * Send as much of the queued output as the port takes
+ *  Return 1 = all sent
+ *         0 = port full, try again when writable
+ *        -1 = Error
+ ********************************************************************/
+static int session_flush (struct update_session *s)
+{
+	struct iovec *iov = s->tx;
+	ssize_t n;
+	int i;
+
+	while (s->txcnt)
+	{
+		n = ser_writev (s->ser, iov, s->txcnt);
+		if (n < 0)
+		{
+			if (EINTR == errno)
+			{
+				continue;
+			}
+			if (EAGAIN == errno)
+			{
+				break;
+			}
+			syslog (LOG_MAKEPRI (LOG_USER, LOG_ERR), "ERROR: write - %s", strerror (errno));
+			return -1;
+		}
+
+		while (s->txcnt && (size_t) n >= iov->iov_len)
+		{
+			n -= iov->iov_len;
+			iov++;
+			s->txcnt--;
+		}
+		if (s->txcnt)
+		{
+			iov->iov_base = (uint8_t *) iov->iov_base + n;
+			iov->iov_len -= n;
+		}
+	}
+
+	// keep the rest at the front
+	for (i = 0; i < s->txcnt; i++)
+	{
+		s->tx[i] = iov[i];
+	}
 
-	if (-1 == hFile)
+	if (s->txcnt)
 	{
-		fprintf (stderr, "ERROR: opening file: %s\n", UpdateFileName);
+		return 0;
+	}
+
+	// the queued chunk is written, its round trip starts now
+	if (s->sent_ns < 0)
+	{
+		s->sent_ns = timing_now_ns ();
+	}
+
+	return 1;
+}
+
+/********************************************************************
+ * Read what is there
+ *  Return number of bytes
+ *         0 = nothing there
+ *        -1 = Error or hang up
+ ********************************************************************/
+static int session_read (struct update_session *s, void *buf, size_t len)
+{
+	ssize_t n;
+
+	do
+	{
+		n = ser_read (s->ser, buf, len);
+	}
+	while (n < 0 && EINTR == errno);
+
+	if (n < 0)
+	{
+		if (EAGAIN == errno)
+		{
+			return 0;
+		}
+		syslog (LOG_MAKEPRI (LOG_USER, LOG_ERR), "ERROR: read - %s", strerror (errno));
 		return -1;
 	}
+	if (0 == n)
+	{
+		// hang up
+		return -1;
+	}
+
+	return n;
+}
+
+/********************************************************************
+ * Leave the update mode of the modem with ESC
+ ********************************************************************/
+static int session_abort (struct update_session *s, int result)
+{
+	s->result = result;
+	s->state = SESSION_ABORT;
+
+	return 1;
+}
+
+/********************************************************************
+ * Fail without touching the modem
+ ********************************************************************/
+static int session_fail (struct update_session *s)
+{
+	s->result = -1;
+	s->state = SESSION_FAILED;
+
+	return 1;
+}
+
+/********************************************************************
+ * State SESSION_VALIDATE
+ ********************************************************************/
+static int session_validate (struct update_session *s)
+{
+	struct catalog_entry entry;
+	const char *fext;
+	int res;
 
 	// get the file extension
-	fext = strrchr (UpdateFileName, '.');
+	fext = strrchr (s->filename, '.');
 	if (NULL == fext)
 	{
 		syslog (LOG_MAKEPRI (LOG_USER, LOG_ERR), "ERROR: Update file has no extension");
 		fprintf (stderr, "ERROR: Update file has no extension.\n");
-		close (hFile);
-		return -1;
+		return session_fail (s);
 	}
 
 #ifdef DEBUG
@@ -94,89 +246,208 @@ int update (int ser, struct modemtype modem, char *UpdateFileName)
 #endif
 
 	// check if file extension matches the modem type
-	if (!strncasecmp (fext, modem.ext, 3))
+	if (NULL == s->modem.ext || strcasecmp (fext + 1, s->modem.ext))
 	{
 		syslog (LOG_MAKEPRI (LOG_USER, LOG_ERR), "ERROR: file extension does not match modem type");
 		fprintf (stderr, "ERROR: file extension does not match modem type.\n");
-		close (hFile);
-		return -1;
+		return session_fail (s);
 	}
 
-	// check firmware file
-	if (modem.ver == 'H' ||
-		modem.ver == 'I' ||
-		modem.ver == 'K')
+	if (fw_open (&s->img, s->filename))
+	{
+		return session_fail (s);
+	}
+	s->img_open = true;
+
+	// check firmware file, unless the catalog knows it unchanged
+	timing_begin (s->tm, PHASE_CHECK);
+	progress_phase (s->pg, "check");
+	if (s->modem.ver == 'H' ||
+		s->modem.ver == 'I' ||
+		s->modem.ver == 'K')
 	{
-		if (dr7check (hFile))
+		if (!catalog_lookup (s->filename, &s->img, &entry) && HEADER_P4 == entry.header)
 		{
-			syslog (LOG_MAKEPRI (LOG_USER, LOG_ERR), "ERROR: firmware CRC check failed");
-			fprintf (stderr, "ERROR: firmware CRC check failed.\n");
-			close (hFile);
-			return -1;
+			res = entry.result;
+		}
+		else
+		{
+			res = dr7check (&s->img, 0);
 		}
 	}
 	else
 	{
-		if (ptccheck (hFile))
+		if (!catalog_lookup (s->filename, &s->img, &entry) && HEADER_PT == entry.header)
 		{
-			syslog (LOG_MAKEPRI (LOG_USER, LOG_ERR), "ERROR: firmware CRC check failed");
-			fprintf (stderr, "ERROR: firmware CRC check failed.\n");
-			close (hFile);
-			return -1;
+			res = entry.result;
+		}
+		else
+		{
+			res = ptccheck (&s->img, 0);
 		}
 	}
+	timing_end (s->tm, PHASE_CHECK);
 
-	lseek (hFile, 12, SEEK_SET);
-	read (hFile, &fileStamp, 4);
+	if (res)
+	{
+		syslog (LOG_MAKEPRI (LOG_USER, LOG_ERR), "ERROR: firmware CRC check failed");
+		fprintf (stderr, "ERROR: firmware CRC check failed.\n");
+		return session_fail (s);
+	}
 
-	fileLength = lseek (hFile, 0, SEEK_END);
+	s->chunks = s->img.size / CHUNKSIZE;
+	if (s->img.size % CHUNKSIZE)
+	{
+		s->chunks++;
+	}
+
+	// the link speed is only touched for a file that will be sent
+	s->state = s->autobaud ? SESSION_LINK : SESSION_ENTER;
 
+	return 1;
+}
+
+/********************************************************************
+ * State SESSION_LINK
+ *  blocks until the fastest usable speed is set
+ ********************************************************************/
+static int session_link (struct update_session *s)
+{
+	struct link_quality lq;
+
+	if (link_negotiate (s->ser, s->ser->baud, s->autobaud, &lq) < 0)
+	{
+		return session_fail (s);
+	}
+
+	s->state = SESSION_ENTER;
+
+	return 1;
+}
+
+/********************************************************************
+ * State SESSION_ENTER
+ ********************************************************************/
+static int session_enter (struct update_session *s)
+{
 	// start update on the modem
-	write (ser, "UPDATE\r", 7);
-	usleep (100000);
+	timing_begin (s->tm, PHASE_HANDSHAKE);
+	progress_phase (s->pg, "handshake");
+
+	session_send (s, "UPDATE\r", 7);
+	s->deadline = ser_now_ms () + UPDATE_TIMEOUT_MS;
+	s->state = SESSION_BANNER;
+
+	return 1;
+}
+
+/********************************************************************
+ * Build the matcher for the echo of the update command, once
+ ********************************************************************/
+static void banner_init (void)
+{
+	static const char *const pattern[] = { UPDATE_BANNER };
+
+	match_init (&banner_match, pattern, 1);
+}
+
+/********************************************************************
+ * State SESSION_BANNER
+ *  read and ignore the UPDATE message, it ends when the modem is quiet
+ ********************************************************************/
+static int session_banner (struct update_session *s)
+{
+	char buf[256];
+	long long now;
+	int n, i, gap;
+
+	pthread_once (&banner_once, banner_init);
+
+	while ((n = session_read (s, buf, sizeof (buf))) > 0)
+	{
+		s->drained += n;
+
+		for (i = 0; i < n && !s->banner; i++)
+		{
+			s->banner = match_step (&banner_match, &s->match, buf[i]) >= 0;
+		}
+
+		// short gap once the banner is seen, otherwise the old one
+		gap = s->banner ? update_idle_ms : SER_IDLE_MS;
+		s->quiet = ser_now_ms () + (gap > s->ser->idle_ms ? gap : s->ser->idle_ms);
+	}
+
+	now = ser_now_ms ();
+	if (n == 0 && now < session_deadline (s))
+	{
+		return 0;
+	}
+
+	if (n < 0 || (!s->banner && 0 == s->drained))
+	{
+		fprintf (stderr, "ERROR: modem does not enter update mode!\n");
+		syslog (LOG_MAKEPRI (LOG_USER, LOG_ERR), "ERROR: no UPDATE answer from modem");
+		return session_fail (s);
+	}
 
 #ifdef DEBUG
-	r = ser_flush (ser);	// read and ignore the UPDATE message
-	printf ("flushed %d bytes\n", r);
-#else
-	ser_flush (ser);	// read and ignore the UPDATE message
+	printf ("flushed %d bytes\n", s->drained);
 #endif
 
-	write (ser, "\006", 1);	// send ACK
-	usleep (1000);
+	session_send (s, "\006", 1);	// send ACK
+	s->rxlen = 0;
+	s->deadline = now + UPDATE_TIMEOUT_MS;
+	s->state = SESSION_FLASHID;
+
+	return 1;
+}
 
-	read (ser, &flashID, 2);
+/********************************************************************
+ * State SESSION_FLASHID
+ ********************************************************************/
+static int session_flashid (struct update_session *s)
+{
+	int n;
+
+	while (s->rxlen < 6 && (n = session_read (s, s->rx + s->rxlen, 6 - s->rxlen)) > 0)
+	{
+		s->rxlen += n;
+	}
+
+	if (s->rxlen < 6)
+	{
+		if (n == 0 && ser_now_ms () < s->deadline)
+		{
+			return 0;
+		}
+
+		fprintf (stderr, "ERROR: no answer from modem!\n");
+		syslog (LOG_MAKEPRI (LOG_USER, LOG_ERR), "ERROR: no FlashID from modem");
+		return session_abort (s, -1);
+	}
+
+	memcpy (&s->flashID, s->rx, 2);
+	memcpy (&s->flashStamp, s->rx + 2, 4);
 
 #ifdef DEBUG
-	printf ("flashID: %04X\n", flashID);
+	printf ("flashID: %04X\n", s->flashID);
 #endif
 
-	read (ser, &flashStamp, 4);
-
 #ifdef DEBUG
-	printf ("File stamp : %08X\n", fileStamp);
-	printf ("Flash stamp: %08X\n", flashStamp);
+	printf ("File stamp : %08X\n", fw_get_long (&s->img, FW_STAMP_OFFSET));
+	printf ("Flash stamp: %08X\n", (unsigned) (s->rx[2] | s->rx[3] << 8 | s->rx[4] << 16 | (uint32_t) s->rx[5] << 24));
 #endif
 
 	// check for Flash ID 0xa41f
 	// and for compatibility: 0x5b1f and 0xda1f
-	if ((0xa41f != flashID) && (0x5b1f != flashID) && (0xda1f != flashID))
+	if ((0xa41f != s->flashID) && (0x5b1f != s->flashID) && (0xda1f != s->flashID))
 	{
 		fprintf (stderr, "ERROR: receiving FlashID!\n");
-		syslog (LOG_MAKEPRI (LOG_USER, LOG_ERR), "ERROR: receiving FlashID. Got %04X", flashID);
-		write (ser, "\033", 1);	// send ESC
-		close (hFile);
-		return -1;
-	}
-
-	chunks = fileLength / CHUNKSIZE;
-
-	if (fileLength % CHUNKSIZE)
-	{
-		chunks++;
+		syslog (LOG_MAKEPRI (LOG_USER, LOG_ERR), "ERROR: receiving FlashID. Got %04X", s->flashID);
+		return session_abort (s, -1);
 	}
 
-	if (flashStamp.day == 0 || flashStamp.month == 0 || (flashStamp.day == 0x1f && flashStamp.month == 0xf && flashStamp.year == 0x7f))
+	if (s->flashStamp.day == 0 || s->flashStamp.month == 0 || (s->flashStamp.day == 0x1f && s->flashStamp.month == 0xf && s->flashStamp.year == 0x7f))
 	{
 		fprintf (stderr, "WARNING: Invalid Flash time stamp.\n"
 						 "         Possibly no firmware installed.\n\n");
@@ -184,8 +455,10 @@ int update (int ser, struct modemtype modem, char *UpdateFileName)
 	}
 
 #ifdef CHECK_TIMESTAMP
-	if (convtime (FileStamp) <= convtime (FlashStamp))
+	if (convtime (s->img.stamp) <= convtime (s->flashStamp))
 	{
+		int res;
+
 		printf("The current firmware has the same or a newer time stamp!\n");
 		printf("Press <P> to proceed or any other key to quit.\n\n");
 
@@ -197,96 +470,368 @@ int update (int ser, struct modemtype modem, char *UpdateFileName)
 
 		if ('p' != (char)res && 'P' != (char)res)
 		{
-			write(ser, "\033", 1);	/* send ESC */
-			close(hFile);
-			return -2;
+			return session_abort (s, -2);
 		}
 	}
 #endif /* CHECK_TIMESTAMP */
 
 #ifdef CHECK_FILE_LENGTH
-	if (fileLength > flashFree)
+	if (s->img.size > flashFree)
 	{
 		fprintf (stderr, "ERROR: File too large!\n       File should not be longer than %ld bytes.\n", flashFree);
-		write (ser, "\033", 1);	// send ESC
-		close (hFile);
-		return -1;
+		return session_abort (s, -1);
 	}
 #endif /* CHECK_FILE_LENGTH */
 
 #if 0
 	// TEST: cancel update here
-	write (ser, "\033", 1);	// send ESC
-	close (hFile);
-
 	fprintf (stderr, "TEST: Update canceled!\n");
-
-	return 0;
+	return session_abort (s, 0);
 #endif
 
-	write (ser, "\006", 1);	// send ACK
+	s->state = SESSION_COUNT;
 
-	// write the number of chunks
-	ch = (char) (chunks >> 8);
-	write (ser, &ch, 1);
-	ch = (char) chunks;
-	write (ser, &ch, 1);
+	// send ACK and the number of chunks
+	s->hdr[0] = ACK;
+	s->hdr[1] = (uint8_t) (s->chunks >> 8);
+	s->hdr[2] = (uint8_t) s->chunks;
+	session_send (s, s->hdr, 3);
+	s->rxlen = 0;
+	s->deadline = ser_now_ms () + UPDATE_TIMEOUT_MS;
 
-	read (ser, &ch, 1);
+	return 1;
+}
 
-	if (ch != ACK)
+/********************************************************************
+ * Queue the staged chunk s->written
+ ********************************************************************/
+static void session_send_chunk (struct update_session *s)
+{
+	int i = s->written & 1;
+	int j;
+
+	for (j = 0; j < s->iovcnt[i]; j++)
 	{
-		fprintf (stderr, "\a\aERROR: Handshake failed!\n");
-		syslog (LOG_MAKEPRI (LOG_USER, LOG_ERR), "ERROR: handshake failed. Rx: %02X", ch);
-		write (ser, "\033", 1);	// send ESC
-		close (hFile);
-		return -1;
+		session_send (s, s->iov[i][j].iov_base, s->iov[i][j].iov_len);
 	}
 
-	syslog (LOG_MAKEPRI (LOG_USER, LOG_INFO), "Updating with file: %s", UpdateFileName);
+	s->sent_ns = -1;			// stamped by session_flush()
+	s->deadline = ser_now_ms () + UPDATE_TIMEOUT_MS;
+	s->wait_ack = false;
+}
 
-	printf ("Writing %ld byte in %d chunks.\n\n", fileLength, chunks);
-	syslog (LOG_MAKEPRI (LOG_USER, LOG_INFO), "Writing %ld byte in %d chunks", fileLength, chunks);
+/********************************************************************
+ * State SESSION_COUNT
+ ********************************************************************/
+static int session_count (struct update_session *s)
+{
+	int n;
 
-	lseek (hFile, 0, SEEK_SET);
+	n = session_read (s, s->rx, 1);
+	if (n == 0 && ser_now_ms () < s->deadline)
+	{
+		return 0;
+	}
 
-	do
+	if (n <= 0 || s->rx[0] != ACK)
 	{
-		bytesRead = read (hFile, &buffer, CHUNKSIZE);
+		fprintf (stderr, "\a\aERROR: Handshake failed!\n");
+		syslog (LOG_MAKEPRI (LOG_USER, LOG_ERR), "ERROR: handshake failed. Rx: %02X", n > 0 ? s->rx[0] : 0);
+		return session_abort (s, -1);
+	}
 
-		if (bytesRead < CHUNKSIZE)
-		{
-			memset (buffer + bytesRead, 0, CHUNKSIZE - bytesRead);
-		}
+	timing_end (s->tm, PHASE_HANDSHAKE);
+
+	syslog (LOG_MAKEPRI (LOG_USER, LOG_INFO), "Updating with file: %s", s->filename);
 
-		write (ser, &buffer, CHUNKSIZE);
-		chunksWritten++;
+	printf ("Writing %zu byte in %d chunks.\n\n", s->img.size, s->chunks);
+	syslog (LOG_MAKEPRI (LOG_USER, LOG_INFO), "Writing %zu byte in %d chunks", s->img.size, s->chunks);
 
-		read (ser, &ch, 1);
+	timing_begin (s->tm, PHASE_TRANSFER);
+	s->xfer_ns = timing_now_ns ();
+	progress_start (s->pg, s->chunks, (uint64_t) s->chunks * CHUNKSIZE);
 
-		if (ch != ACK)
+	// prime the pipeline with the first chunk
+	s->iovcnt[0] = stage_chunk (&s->img, 0, s->iov[0]);
+	s->written = 0;
+	session_send_chunk (s);
+	s->state = SESSION_CHUNKS;
+
+	return 1;
+}
+
+/********************************************************************
+ * State SESSION_CHUNKS
+ ********************************************************************/
+static int session_chunks (struct update_session *s)
+{
+	int n;
+
+	if (!s->wait_ack)
+	{
+		// the chunk is out: while the modem writes the flash, stage the next one
+		s->written++;
+		if (s->written < s->chunks)
 		{
-			fprintf (stderr, "\a\aERROR: Handshake failed!\n");
-			fprintf (stderr, "Char: %02X\n", ch);
-			write (ser, "\033", 1);	// send ESC
-			close (hFile);
-			return -1;
+			s->iovcnt[s->written & 1] = stage_chunk (&s->img, s->written, s->iov[s->written & 1]);
 		}
+		s->wait_ack = true;
+		s->deadline = ser_now_ms () + UPDATE_ACK_TIMEOUT_MS;
+
+		return 0;	// the ACK cannot be there yet
+	}
+
+	n = session_read (s, s->rx, 1);
+	if (n == 0 && ser_now_ms () < s->deadline)
+	{
+		return 0;
+	}
 
-		sprintf (buffer, "Written: %3ld%%\r", chunksWritten * 100 / chunks);
-		write (STDOUT_FILENO, buffer, strlen (buffer));
+	if (n <= 0 || s->rx[0] != ACK)
+	{
+		fprintf (stderr, "\a\aERROR: Handshake failed!\n");
+		fprintf (stderr, "Char: %02X\n", n > 0 ? s->rx[0] : 0);
+		return session_abort (s, -1);
+	}
+	timing_chunk (s->tm, s->sent_ns, timing_now_ns (), CHUNKSIZE);
 
-	} while (bytesRead == CHUNKSIZE);
+	progress_chunk (s->pg, s->written, (uint64_t) s->written * CHUNKSIZE);
 
-	write (ser, "\r", 1);
+	if (s->written < s->chunks)
+	{
+		session_send_chunk (s);
+	}
+	else
+	{
+		s->state = SESSION_FINISH;
+	}
+
+	return 1;
+}
+
+/********************************************************************
+ * State SESSION_FINISH
+ ********************************************************************/
+static int session_finish (struct update_session *s)
+{
+	double secs = (timing_now_ns () - s->xfer_ns) / 1e9;
+	double rate = secs > 0 ? (double) s->chunks * CHUNKSIZE / secs : 0;
+
+	timing_end (s->tm, PHASE_TRANSFER);
+
+	session_send (s, "\r", 1);
+	s->deadline = ser_now_ms () + UPDATE_TIMEOUT_MS;
 
 	printf ("\n\n\aUpdate complete.\n");
+	printf ("Transfer: %.2f s, %.1f kB/s\n", secs, rate / 1000.0);
+	syslog (LOG_MAKEPRI (LOG_USER, LOG_INFO), "%s: transfer %.2f s, %.1f kB/s", s->ser->name, secs, rate / 1000.0);
 
-	close (hFile);
+	s->result = 0;
+	s->state = SESSION_DONE;
+
+	return 1;
+}
+
+
+/********************************************************************
+ * Start an update session
+ *  the port is switched to non-blocking mode until session_free(),
+ *  autobaud > 0 raises the speed up to that limit once the file
+ *  is checked, link_restore() sets it back after a failure
+ * Return:
+ *  0 = Ok
+ *  negative = Error
+ ********************************************************************/
+int session_init (struct update_session *s, struct ser_port *ser, struct modemtype modem, const char *filename, int autobaud, struct timing *tm, struct progress *pg)
+{
+	memset (s, 0, sizeof (*s));
+
+	s->ser = ser;
+	s->modem = modem;
+	s->filename = filename;
+	s->autobaud = autobaud;
+	s->tm = tm;
+	s->pg = pg;
+	s->state = SESSION_VALIDATE;
+	s->result = -1;
+
+	s->flags = fcntl (ser->fd, F_GETFL);
+	if (s->flags < 0 || fcntl (ser->fd, F_SETFL, s->flags | O_NONBLOCK) < 0)
+	{
+		syslog (LOG_MAKEPRI (LOG_USER, LOG_ERR), "ERROR: fcntl - %s", strerror (errno));
+		return -1;
+	}
 
 	return 0;
 }
 
+/********************************************************************
+ * Advance the session as far as the port allows without blocking
+ *  call it whenever the port gets ready for session_events()
+ *  or session_deadline() has passed
+ * Return:
+ *  1 = running
+ *  0 = update done
+ *  negative = update failed (-2 = canceled)
+ ********************************************************************/
+int session_step (struct update_session *s)
+{
+	bool final;
+	int r;
+
+	for (;;)
+	{
+		final = (s->state >= SESSION_DONE);
+
+		// queued output goes first
+		r = s->txcnt ? session_flush (s) : 1;
+		if (0 == r && ser_now_ms () >= s->deadline)
+		{
+			errno = ETIMEDOUT;
+			r = -1;
+		}
+		if (r < 0)
+		{
+			s->txcnt = 0;
+			if (!final)
+			{
+				fprintf (stderr, "ERROR: writing to modem!\n");
+				session_fail (s);
+			}
+			continue;
+		}
+		if (0 == r)
+		{
+			return 1;
+		}
+
+		switch (s->state)
+		{
+			case SESSION_VALIDATE:
+				r = session_validate (s);
+				break;
+
+			case SESSION_LINK:
+				r = session_link (s);
+				break;
+
+			case SESSION_ENTER:
+				r = session_enter (s);
+				break;
+
+			case SESSION_BANNER:
+				r = session_banner (s);
+				break;
+
+			case SESSION_FLASHID:
+				r = session_flashid (s);
+				break;
+
+			case SESSION_COUNT:
+				r = session_count (s);
+				break;
+
+			case SESSION_CHUNKS:
+				r = session_chunks (s);
+				break;
+
+			case SESSION_FINISH:
+				r = session_finish (s);
+				break;
+
+			case SESSION_ABORT:
+				session_send (s, "\033", 1);	// send ESC
+				s->deadline = ser_now_ms () + UPDATE_TIMEOUT_MS;
+				s->state = SESSION_FAILED;
+				r = 1;
+				break;
+
+			case SESSION_DONE:
+			case SESSION_FAILED:
+				if (s->img_open)
+				{
+					fw_close (&s->img);
+					s->img_open = false;
+				}
+				return s->result;
+		}
+
+		if (0 == r)
+		{
+			return 1;
+		}
+	}
+}
+
+/********************************************************************
+ * Events the session waits for (POLLIN / POLLOUT)
+ ********************************************************************/
+short session_events (const struct update_session *s)
+{
+	return s->txcnt ? POLLOUT : POLLIN;
+}
+
+/********************************************************************
+ * Time (ser_now_ms() base) when session_step() must run
+ *  even if the port does not get ready
+ ********************************************************************/
+long long session_deadline (const struct update_session *s)
+{
+	if (SESSION_BANNER == s->state && !s->txcnt &&
+		s->drained && s->quiet < s->deadline)
+	{
+		return s->quiet;
+	}
+
+	return s->deadline;
+}
+
+/********************************************************************
+ * End a session
+ *  closes the image and restores the file status flags of the port
+ ********************************************************************/
+void session_free (struct update_session *s)
+{
+	if (s->img_open)
+	{
+		fw_close (&s->img);
+		s->img_open = false;
+	}
+
+	fcntl (s->ser->fd, F_SETFL, s->flags);
+}
+
+
+/********************************************************************
+ * Update the modem firmware
+ *  a blocking loop around an update session
+ * Return:
+ *  0 = Ok
+ *  -1 = Error
+ *  -2 = canceled by user
+ ********************************************************************/
+int update (struct ser_port *ser, struct modemtype modem, char *UpdateFileName, int autobaud, struct timing *tm, struct progress *pg)
+{
+	struct update_session s;
+	long long left;
+	int r;
+
+	if (session_init (&s, ser, modem, UpdateFileName, autobaud, tm, pg))
+	{
+		return -1;
+	}
+
+	while ((r = session_step (&s)) > 0)
+	{
+		left = session_deadline (&s) - ser_now_ms ();
+		ser_poll_ms (ser, session_events (&s), left < 0 ? 0 : left);
+	}
+
+	session_free (&s);
+
+	return r;
+}
+
 #ifdef CHECK_TIMESTAMP
 /********************************************************************
  *
@@ -32,7 +32,14 @@
 /********************************************************************
  * Include files
  ********************************************************************/
+#include <stdint.h>
+#include <stdbool.h>
+#include <sys/uio.h>
+
 #include "ptc.h"
+#include "fwimage.h"
+#include "timing.h"
+#include "progress.h"
 
 
 /********************************************************************
@@ -40,6 +47,12 @@
  ********************************************************************/
 #define CHUNKSIZE 256
 
+#define UPDATE_TIMEOUT_MS		2000	// handshake answers
+#define UPDATE_ACK_TIMEOUT_MS	10000	// ACK of a chunk, includes flash erase
+#define UPDATE_IDLE_MS			20		// default silence after the UPDATE banner
+
+#define UPDATE_BANNER	"UPDATE"		// echo of the update command
+
 #define ACK '\006'
 #define ESC '\033'
 
@@ -47,21 +60,76 @@
 /********************************************************************
  * Types
  ********************************************************************/
-typedef struct _FDTIME
-{
-	unsigned int twosecs :5;
-	unsigned int minutes :6;
-	unsigned int hours :5;
-	unsigned int day :5;
-	unsigned int month :4;
-	unsigned int year :7;	// = year - 1980
-} FDTIME;
+enum session_state {
+	SESSION_VALIDATE,	// extension, image and CRC check
+	SESSION_LINK,		// link_negotiate(), only with autobaud
+	SESSION_ENTER,		// send UPDATE
+	SESSION_BANNER,		// skip the UPDATE message until the modem is quiet
+	SESSION_FLASHID,	// read flash ID and time stamp
+	SESSION_COUNT,		// send the number of chunks and wait for the ACK
+	SESSION_CHUNKS,		// stream the chunks, one ACK each
+	SESSION_FINISH,		// final CR
+	SESSION_ABORT,		// send ESC
+	SESSION_DONE,
+	SESSION_FAILED
+};
+
+struct update_session {
+	struct ser_port *ser;
+	struct modemtype modem;
+	const char *filename;
+	struct timing *tm;			// may be NULL
+	struct progress *pg;		// may be NULL
+	int autobaud;				// max. baudrate for link_negotiate, 0 = off
+
+	enum session_state state;
+	int result;					// 0 = Ok, -1 = Error, -2 = canceled
+	int flags;					// file status flags of ser before the session
+	long long deadline;			// ms, for the current state
+	long long quiet;			// ms, end of the idle gap after the banner
+
+	struct fw_image img;
+	bool img_open;
+	uint16_t flashID;
+	FDTIME flashStamp;
+	unsigned short chunks;
+	unsigned long written;		// chunks sent
+	bool wait_ack;				// chunk sent, ACK pending
+	long long sent_ns;			// ns, last byte of the chunk written, -1 = queued
+	long long xfer_ns;			// start of the chunk transfer
+
+	// output in progress
+	struct iovec tx[3];
+	int txcnt;
+	uint8_t hdr[3];
+	struct iovec iov[2][2];		// current and next chunk
+	int iovcnt[2];
+
+	// input in progress
+	uint8_t rx[6];
+	size_t rxlen;
+	int match;					// matcher state for UPDATE_BANNER
+	bool banner;				// UPDATE_BANNER seen
+	int drained;				// bytes of the UPDATE message
+};
+
+
+/********************************************************************
+ * Global variables
+ ********************************************************************/
+extern int update_idle_ms;
 
 
 /********************************************************************
  * Function Prototypes
  ********************************************************************/
-int update (int ser, struct modemtype modem, char *UpdateFileName);
+int session_init (struct update_session *s, struct ser_port *ser, struct modemtype modem, const char *filename, int autobaud, struct timing *tm, struct progress *pg);
+int session_step (struct update_session *s);
+short session_events (const struct update_session *s);
+long long session_deadline (const struct update_session *s);
+void session_free (struct update_session *s);
+
+int update (struct ser_port *ser, struct modemtype modem, char *UpdateFileName, int autobaud, struct timing *tm, struct progress *pg);
 #ifdef CHECK_TIMESTAMP
 time_t convtime (FDTIME PTC_Time);
 #endif /* CHECK_TIMESTAMP */
@@ -0,0 +1,234 @@
+/********************************************************************
+ *
+ * usbdev.c -- SCS modems with USB port
+ *
+ * Copyright (C) 1998 - 2021 SCS GmbH & Co. KG, Hanau, Germany
+ * written by Peter Mack (peter.mack@scs-ptc.com)
+ *
+ * MIT License
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ *
+ ********************************************************************/
+
+
+#define _GNU_SOURCE
+
+/********************************************************************
+ * Include files
+ ********************************************************************/
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <limits.h>
+#include <dirent.h>
+
+#include "usbdev.h"
+
+
+/********************************************************************
+ * Defines
+ ********************************************************************/
+#define SYSFS_PATH "/sys/bus/usb/devices/%u-"
+
+
+/********************************************************************
+ * Global Variables
+ ********************************************************************/
+const struct Modem modems[] = {
+	{"PTC-IIusb",			115200},	// 0
+	{"Tracker / DSP TNC",	 38400},	// 1
+	{"P4dragon DR-7800",	829440},	// 2
+	{"P4dragon DR-7400",	829440},	// 3
+	{"", 0},							// 4
+	{"PTC-IIIusb",			115200},	// 5
+	{"", 0},							// 6
+	{"", 0}								// 7
+};
+
+
+/********************************************************************
+ * Helper function for scandir
+ * to find the USB serial device name
+ ********************************************************************/
+static int srchtty (const struct dirent *ep)
+{
+	if (strstr (ep->d_name, "ttyUSB"))
+	{
+		return 1;
+	}
+
+	return 0;
+}
+
+
+/********************************************************************
+ * Helper function to free dirent structure
+ ********************************************************************/
+static void free_dirent (struct dirent ***ent, int n)
+{
+	struct dirent **ep;
+
+	ep = *ent;
+	for (int i = 0; i < n; i++)
+	{
+		free (ep[i]);
+	}
+	free (ep);
+}
+
+
+/********************************************************************
+ * sysfs directory of the serial interface of a USB device
+ *  e.g. /sys/bus/usb/devices/1-2.4:1.0/
+ * Return:
+ *  0 = Ok
+ *  negative = Error
+ ********************************************************************/
+int usb_iface_path (libusb_device *dev, char *path, size_t size)
+{
+#define PNUM_MAX 8
+	uint8_t pnums[PNUM_MAX];
+	int numports;
+	size_t len;
+	int n;
+
+	numports = libusb_get_port_numbers (dev, pnums, PNUM_MAX);
+	if (numports < 1)
+	{
+		return -1;
+	}
+
+	len = snprintf (path, size, SYSFS_PATH, libusb_get_bus_number (dev));
+
+	for (n = 0; n < numports - 1 && len < size; n++)
+	{
+		len += snprintf (path + len, size - len, "%u.", pnums[n]);
+	}
+	if (len < size)
+	{
+		len += snprintf (path + len, size - len, "%u:1.0/", pnums[n]);
+	}
+
+	return len < size ? 0 : -1;
+}
+
+
+/********************************************************************
+ * tty device of a USB serial interface
+ *  the directory is empty until the driver has bound to it
+ * Return:
+ *  0 = Ok, e.g. /dev/ttyUSB1
+ *  negative = no or more than one tty
+ ********************************************************************/
+int usb_iface_tty (const char *path, char *tty, size_t size)
+{
+	struct dirent **ent;
+	int n;
+
+	n = scandir (path, &ent, srchtty, alphasort);
+	if (n < 0)
+	{
+		return -1;
+	}
+
+	if (1 == n)
+	{
+		// tty name is in ent[0]->d_name
+		snprintf (tty, size, "/dev/%s", ent[0]->d_name);
+	}
+
+	free_dirent (&ent, n);
+
+	return 1 == n ? 0 : -1;
+}
+
+
+/********************************************************************
+ * Search for SCS USB devices
+ ********************************************************************/
+int find_devices (struct SCS_Devices devs[])
+{
+	int err = 0;
+	libusb_context *ctx;
+	libusb_device **list;
+	struct libusb_device_descriptor desc;
+	int status;
+	ssize_t num_devs, i;
+	char path[PATH_MAX];
+
+	status = 0;	// 0 device not found, > 0 device found
+
+	err = libusb_init (&ctx);
+	if (err)
+	{
+		fprintf (stderr, "ERROR: unable to initialize libusb: %i\n", err);
+		goto error;
+	}
+
+	num_devs = libusb_get_device_list (ctx, &list);
+	if (num_devs < 0)
+	{
+		fprintf (stderr, "ERROR: getting device list: %li\n", num_devs);
+		goto error1;
+	}
+
+	for (i = 0; i < num_devs && status < MAX_SCS_DEVICES; ++i)
+	{
+		libusb_device *dev = list[i];
+
+		libusb_get_device_descriptor (dev, &desc);
+		if (!SCS_USB_MATCH (desc.idVendor, desc.idProduct))
+			continue;
+
+#ifdef DEBUG
+		printf ("ID %04x:%04x - ", desc.idVendor, desc.idProduct);
+#endif /* DEBUG */
+
+		if (usb_iface_path (dev, path, sizeof (path)))
+		{
+			continue;
+		}
+
+#ifdef DEBUG
+		printf ("%s -> ", path);
+#endif /* DEBUG */
+
+		if (usb_iface_tty (path, devs[status].tty, sizeof (devs[status].tty)))
+		{
+			fprintf (stderr, "USB search: tty search error (%s)\n", path);
+			continue;
+		}
+
+#ifdef DEBUG
+		printf ("%s\n", devs[status].tty);
+#endif /* DEBUG */
+
+		devs[status].type = SCS_USB_TYPE (desc.idProduct);
+		status++;
+	}
+
+	libusb_free_device_list (list, 0);
+
+error1:
+	libusb_exit (ctx);
+
+error:
+	return status;
+}
@@ -0,0 +1,88 @@
+/********************************************************************
+ *
+ * usbdev.h -- SCS modems with USB port
+ *
+ * Copyright (C) 1998 - 2021 SCS GmbH & Co. KG, Hanau, Germany
+ * written by Peter Mack (peter.mack@scs-ptc.com)
+ *
+ * MIT License
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ *
+ ********************************************************************/
+
+#pragma once
+
+/********************************************************************
+ * Include files
+ ********************************************************************/
+#include <stddef.h>
+#include <stdint.h>
+#include <libusb-1.0/libusb.h>
+
+
+/*
+ USB Product IDs of the SCS devices:
+    0xD010 SCS PTC-IIusb
+    0xD011 SCS Tracker / DSP TNC
+    0xD012 SCS P4dragon DR-7800
+    0xD013 SCS P4dragon DR-7400
+    0xD014 - not used
+    0xD015 SCS PTC-IIIusb
+    0xD016 - not used
+    0xD017 - not used
+*/
+
+
+/********************************************************************
+ * Defines
+ ********************************************************************/
+#define SCS_USB_VID		0x0403
+#define SCS_USB_PID		0xD010		// the low three bits are the type
+#define SCS_USB_TYPE(pid)	((pid) & 0x7)
+#define SCS_USB_MATCH(vid, pid)	(SCS_USB_VID == (vid) && SCS_USB_PID == ((pid) & 0xFFF8))
+#define MAX_SCS_DEVICES 8		// max. number of SCS devices we search for
+
+
+/********************************************************************
+ * Structs
+ ********************************************************************/
+struct Modem {
+	const char *type;
+	const int baud;
+};
+
+struct SCS_Devices {
+	char tty[270];	// the tty device, e.g. /dev/ttyUSB1
+	uint8_t type;	// index to the modems array
+};
+
+
+/********************************************************************
+ * Global Variables
+ ********************************************************************/
+extern const struct Modem modems[];
+
+
+/********************************************************************
+ * Function prototypes
+ ********************************************************************/
+int usb_iface_path (libusb_device *dev, char *path, size_t size);
+int usb_iface_tty (const char *path, char *tty, size_t size);
+int find_devices (struct SCS_Devices devs[]);